@@ -0,0 +1,456 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "cgen.h"
+#include "hashtable.h"
+
+static char *op_names[] = {
+	[W_OP_NULL] = "W_OP_NULL",
+	[W_OP_INT] = "W_OP_INT",
+	[W_OP_FLOAT] = "W_OP_FLOAT",
+	[W_OP_STRING] = "W_OP_STRING",
+	[W_OP_CONST] = "W_OP_CONST",
+	[W_OP_VAR] = "W_OP_VAR",
+	[W_OP_THIS] = "W_OP_THIS",
+	[W_OP_INDEX] = "W_OP_INDEX",
+	[W_OP_INDEX_BORROW] = "W_OP_INDEX_BORROW",
+	[W_OP_ENTER] = "W_OP_ENTER",
+	[W_OP_LEAVE] = "W_OP_LEAVE",
+	[W_OP_LOOKUP] = "W_OP_LOOKUP",
+	[W_OP_CALL] = "W_OP_CALL",
+	[W_OP_METHOD] = "W_OP_METHOD",
+	[W_OP_ARG] = "W_OP_ARG",
+	[W_OP_INVOKE] = "W_OP_INVOKE",
+	[W_OP_TAIL] = "W_OP_TAIL",
+	[W_OP_POP] = "W_OP_POP",
+	[W_OP_GUARD] = "W_OP_GUARD",
+	[W_OP_ADD] = "W_OP_ADD",
+	[W_OP_SUB] = "W_OP_SUB",
+	[W_OP_MUL] = "W_OP_MUL",
+	[W_OP_DIV] = "W_OP_DIV",
+	[W_OP_MOD] = "W_OP_MOD",
+	[W_OP_EQU] = "W_OP_EQU",
+	[W_OP_NEQ] = "W_OP_NEQ",
+	[W_OP_LT] = "W_OP_LT",
+	[W_OP_LTE] = "W_OP_LTE",
+	[W_OP_GT] = "W_OP_GT",
+	[W_OP_GTE] = "W_OP_GTE",
+	[W_OP_JUMP] = "W_OP_JUMP",
+	[W_OP_JUMP_IF_NOT] = "W_OP_JUMP_IF_NOT",
+	[W_OP_LOOP] = "W_OP_LOOP",
+	[W_OP_FOR_INIT] = "W_OP_FOR_INIT",
+	[W_OP_FOR_NEXT] = "W_OP_FOR_NEXT",
+	[W_OP_FOR_END] = "W_OP_FOR_END",
+	[W_OP_RETURN] = "W_OP_RETURN",
+	[W_OP_END] = "W_OP_END"
+};
+
+// C operators for the instructions with an inline path for ints
+static char *binary_ops[] = {
+	[W_OP_ADD] = "+", [W_OP_SUB] = "-", [W_OP_MUL] = "*",
+	[W_OP_EQU] = "==", [W_OP_NEQ] = "!=", [W_OP_LT] = "<", [W_OP_LTE] = "<=", [W_OP_GT] = ">", [W_OP_GTE] = ">="
+};
+
+typedef struct cgen {
+	FILE *fp;
+	char *filename; // filename of the program, written once as w_file
+	size_t ids; // number of names given out
+	w_layout_t **layouts;
+	size_t layouts_len, layouts_cap;
+} cgen_t;
+
+// writes a C string literal
+static void print_string(FILE *fp, char *ptr, size_t len) {
+	fputc('"', fp);
+	for(size_t i = 0; i < len; i++) {
+		unsigned char c = ptr[i];
+		if(c == '"' || c == '\\' || c == '?')
+			fprintf(fp, "\\%c", c);
+		else if(c >= ' ' && c <= '~')
+			fputc(c, fp);
+		else
+			fprintf(fp, "\\%03o", c);
+	}
+	fputc('"', fp);
+}
+
+// writes an int64_t literal. INT64_MIN can't be written as a negated constant.
+static void print_int(FILE *fp, int64_t v) {
+	if(v == INT64_MIN)
+		fprintf(fp, "INT64_MIN");
+	else
+		fprintf(fp, "INT64_C(%" PRId64 ")", v);
+}
+
+static void print_astring(FILE *fp, w_astring_t *str) {
+	fprintf(fp, "{%zu, (char []){", str->len);
+	print_string(fp, str->ptr, str->len);
+	fprintf(fp, "}}");
+}
+
+static size_t layout_id(cgen_t *g, w_layout_t *layout) {
+	for(size_t i = 0; i < g->layouts_len; i++)
+		if(g->layouts[i] == layout)
+			return i;
+	return SIZE_MAX;
+}
+
+static void print_layout_ref(cgen_t *g, w_layout_t *layout) {
+	size_t id = layout == NULL ? SIZE_MAX : layout_id(g, layout);
+	if(id == SIZE_MAX)
+		fprintf(g->fp, "NULL");
+	else
+		fprintf(g->fp, "&l%zu", id);
+}
+
+static void collect_layouts(cgen_t *g, w_ast_t *ast) {
+	switch(ast->type) {
+		case W_AST_COMMANDS: {
+			w_layout_t *layout = ast->commands.layout;
+			if(layout != NULL) {
+				if(g->layouts_len >= g->layouts_cap) {
+					g->layouts_cap = g->layouts_cap == 0 ? 16 : g->layouts_cap*2;
+					g->layouts = realloc(g->layouts, sizeof(w_layout_t *)*g->layouts_cap);
+				}
+				g->layouts[g->layouts_len++] = layout;
+			}
+			for(size_t i = 0; i < ast->commands.len; i++)
+				for(size_t j = 0; j < ast->commands.ptr[i].len; j++)
+					collect_layouts(g, &ast->commands.ptr[i].ptr[j]);
+			break;
+		}
+		case W_AST_INDEX:
+			collect_layouts(g, ast->index.left);
+			collect_layouts(g, ast->index.right);
+			break;
+		default:
+			break;
+	}
+}
+
+static void print_layouts(cgen_t *g) {
+	FILE *fp = g->fp;
+	for(size_t i = 0; i < g->layouts_len; i++)
+		fprintf(fp, "static w_layout_t l%zu;\n", i);
+	for(size_t i = 0; i < g->layouts_len; i++) {
+		w_layout_t *layout = g->layouts[i];
+		if(layout->len != 0) {
+			fprintf(fp, "static w_astring_t ln%zu[] = {", i);
+			for(size_t j = 0; j < layout->len; j++) {
+				if(j != 0)
+					fprintf(fp, ", ");
+				print_astring(fp, &layout->names[j]);
+			}
+			fprintf(fp, "};\nstatic w_sym_t *ls%zu[%zu];\n", i, layout->len);
+			fprintf(fp, "static w_layout_t l%zu = {%zu, ln%zu, ls%zu, ", i, layout->len, i, i);
+		}
+		else
+			fprintf(fp, "static w_layout_t l%zu = {0, NULL, NULL, ", i);
+		// hashes are seeded differently in every process, so the bloom filter is made again by w_cgen_main
+		fprintf(fp, "%zu, 0, ", layout->argc);
+		print_layout_ref(g, layout->parent);
+		fprintf(fp, "};\n");
+	}
+}
+
+// whether an instruction can jump to its arg
+static bool jumps(w_opcode_t op) {
+	switch(op) {
+		case W_OP_LOOKUP:
+		case W_OP_CALL:
+		case W_OP_METHOD:
+		case W_OP_ARG:
+		case W_OP_GUARD:
+		case W_OP_JUMP:
+		case W_OP_JUMP_IF_NOT:
+		case W_OP_LOOP:
+		case W_OP_FOR_INIT:
+		case W_OP_FOR_NEXT:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// writes the native code for a block. it's a function that can be entered at the start of the chunk and wherever a loop
+// handler resumes it, with a label for each of those and each jump target.
+static void print_native(cgen_t *g, w_ast_t *ast, size_t id) {
+	FILE *fp = g->fp;
+	w_chunk_t *chunk = w_compile(ast);
+	bool *labels = calloc(chunk->len, sizeof(bool));
+	labels[0] = true;
+	for(size_t i = 0; i < chunk->handlers_len; i++)
+		labels[chunk->handlers[i].brk] = labels[chunk->handlers[i].cont] = true;
+	bool *entries = malloc(sizeof(bool)*chunk->len);
+	memcpy(entries, labels, sizeof(bool)*chunk->len);
+	for(size_t i = 0; i < chunk->len; i++)
+		if(jumps(chunk->code[i].op))
+			labels[chunk->code[i].arg] = true;
+	fprintf(fp, "static w_vm_result_t run%zu(w_chunk_t *chunk, w_vm_t *vm, w_insn_t *ip) {\n", id);
+	fprintf(fp, "\tw_insn_t *code = chunk->code;\n\tswitch(ip-code) {\n");
+	for(size_t i = 0; i < chunk->len; i++)
+		if(entries[i])
+			fprintf(fp, "\t\tcase %zu: goto i%zu;\n", i, i);
+	fprintf(fp, "\t}\n");
+	for(size_t i = 0; i < chunk->len; i++) {
+		w_insn_t *insn = &chunk->code[i];
+		if(labels[i])
+			fprintf(fp, "\ti%zu:\n", i);
+		fprintf(fp, "\t");
+		switch(insn->op) {
+			case W_OP_INT:
+				fprintf(fp, "W_CGEN_INT(");
+				print_int(fp, insn->int_);
+				fprintf(fp, ");\n");
+				break;
+			case W_OP_JUMP:
+				fprintf(fp, "goto i%zu;\n", insn->arg);
+				break;
+			case W_OP_JUMP_IF_NOT:
+				fprintf(fp, "W_CGEN_JUMP_IF_NOT(%zu, i%zu)\n", i, insn->arg);
+				break;
+			case W_OP_LOOP:
+				fprintf(fp, "W_CGEN_LOOP(%zu, i%zu)\n", i, insn->arg);
+				break;
+			case W_OP_ADD:
+			case W_OP_SUB:
+			case W_OP_MUL:
+			case W_OP_EQU:
+			case W_OP_NEQ:
+			case W_OP_LT:
+			case W_OP_LTE:
+			case W_OP_GT:
+			case W_OP_GTE:
+				fprintf(fp, "W_CGEN_BINARY(%zu, %s, %s)\n", i, op_names[insn->op], binary_ops[insn->op]);
+				break;
+			case W_OP_END:
+				fprintf(fp, "return W_VM_END;\n");
+				break;
+			default:
+				if(jumps(insn->op))
+					fprintf(fp, "W_CGEN_BRANCH(%zu, %s, i%zu)\n", i, op_names[insn->op], insn->arg);
+				else
+					fprintf(fp, "W_CGEN_OP(%zu, %s)\n", i, op_names[insn->op]);
+				break;
+		}
+	}
+	fprintf(fp, "}\nstatic w_native_t r%zu = {%zu, &run%zu};\n", id, chunk->len, id);
+	free(labels);
+	free(entries);
+	w_chunk_free(chunk);
+}
+
+static void print_init(cgen_t *g, w_ast_t *ast, size_t id);
+
+// writes the definitions needed by the initializer of a node, and returns the name they were given
+static size_t define(cgen_t *g, w_ast_t *ast) {
+	FILE *fp = g->fp;
+	switch(ast->type) {
+		case W_AST_COMMANDS: {
+			w_ast_commands_t *cmds = &ast->commands;
+			size_t *args = malloc(sizeof(size_t)*cmds->len);
+			for(size_t i = 0; i < cmds->len; i++) {
+				w_ast_command_t *cmd = &cmds->ptr[i];
+				size_t *ids = malloc(sizeof(size_t)*cmd->len);
+				for(size_t j = 0; j < cmd->len; j++)
+					ids[j] = define(g, &cmd->ptr[j]);
+				args[i] = g->ids++;
+				fprintf(fp, "static w_ast_t a%zu[] = {\n", args[i]);
+				for(size_t j = 0; j < cmd->len; j++) {
+					fprintf(fp, "\t");
+					print_init(g, &cmd->ptr[j], ids[j]);
+					fprintf(fp, ",\n");
+				}
+				fprintf(fp, "};\n");
+				free(ids);
+			}
+			size_t id = g->ids++;
+			print_native(g, ast, id);
+			if(cmds->len != 0) {
+				fprintf(fp, "static w_ast_command_t c%zu[] = {", id);
+				for(size_t i = 0; i < cmds->len; i++)
+					fprintf(fp, "%s{%zu, a%zu, NULL}", i == 0 ? "" : ", ", cmds->ptr[i].len, args[i]);
+				fprintf(fp, "};\n");
+			}
+			free(args);
+			return id;
+		}
+		case W_AST_INDEX: {
+			size_t left = define(g, ast->index.left), right = define(g, ast->index.right);
+			size_t id = g->ids++;
+			fprintf(fp, "static w_ast_t n%zu[] = {\n\t", id);
+			print_init(g, ast->index.left, left);
+			fprintf(fp, ",\n\t");
+			print_init(g, ast->index.right, right);
+			fprintf(fp, "\n};\n");
+			return id;
+		}
+		case W_AST_CONST: {
+			// constants are lists of ints, floats and nulls. they're copied when evaluated, so the static list is never changed.
+			w_list_t *l = ast->value->list;
+			size_t id = g->ids++;
+			if(l->len != 0) {
+				fprintf(fp, "static w_value_t kv%zu[] = {", id);
+				for(size_t i = 0; i < l->len; i++) {
+					w_value_t *v = &l->ptr[i];
+					fprintf(fp, "%s", i == 0 ? "" : ", ");
+					if(v->type == W_VALUE_INT) {
+						fprintf(fp, "{.type = W_VALUE_INT, .int_ = ");
+						print_int(fp, v->int_);
+						fprintf(fp, "}");
+					}
+					else if(v->type == W_VALUE_FLOAT)
+						fprintf(fp, "{.type = W_VALUE_FLOAT, .float_ = %a}", v->float_);
+					else
+						fprintf(fp, "{.type = W_VALUE_NULL}");
+				}
+				fprintf(fp, "};\nstatic w_list_t kl%zu = {1, %zu, kv%zu};\n", id, l->len, id);
+			}
+			else
+				fprintf(fp, "static w_list_t kl%zu = {1, 0, NULL};\n", id);
+			fprintf(fp, "static w_value_t k%zu = {.type = W_VALUE_LIST, .list = &kl%zu};\n", id, id);
+			return id;
+		}
+		default:
+			return 0;
+	}
+}
+
+static void print_init(cgen_t *g, w_ast_t *ast, size_t id) {
+	static char *types[] = {
+		[W_AST_STRING] = "W_AST_STRING",
+		[W_AST_VAR] = "W_AST_VAR",
+		[W_AST_INT] = "W_AST_INT",
+		[W_AST_FLOAT] = "W_AST_FLOAT",
+		[W_AST_NULL] = "W_AST_NULL",
+		[W_AST_CONST] = "W_AST_CONST",
+		[W_AST_COMMANDS] = "W_AST_COMMANDS",
+		[W_AST_INDEX] = "W_AST_INDEX"
+	};
+	FILE *fp = g->fp;
+	fprintf(fp, "{.type = %s, ", types[ast->type]);
+	if(ast->member != W_MEMBER_NONE)
+		fprintf(fp, ".member = %d, ", ast->member);
+	fprintf(fp, ".pos = {");
+	if(ast->pos.filename == NULL)
+		fprintf(fp, "NULL");
+	else if(strcmp(ast->pos.filename, g->filename) == 0)
+		fprintf(fp, "w_file");
+	else {
+		fprintf(fp, "(char []){");
+		print_string(fp, ast->pos.filename, strlen(ast->pos.filename));
+		fprintf(fp, "}");
+	}
+	fprintf(fp, ", %zu, %zu}", ast->pos.line, ast->pos.col);
+	switch(ast->type) {
+		case W_AST_STRING:
+		case W_AST_VAR:
+			fprintf(fp, ", .string = ");
+			print_astring(fp, &ast->string);
+			fprintf(fp, ", .slot = {");
+			print_layout_ref(g, ast->slot.layout);
+			fprintf(fp, ", %" PRIu32 ", %" PRIu32 "}", ast->slot.depth, ast->slot.index);
+			break;
+		case W_AST_INT:
+			fprintf(fp, ", .int_ = ");
+			print_int(fp, ast->int_);
+			break;
+		case W_AST_FLOAT:
+			fprintf(fp, ", .float_ = %a", ast->float_);
+			break;
+		case W_AST_NULL:
+			break;
+		case W_AST_CONST:
+			fprintf(fp, ", .value = &k%zu", id);
+			break;
+		case W_AST_COMMANDS:
+			fprintf(fp, ", .commands = {%zu, ", ast->commands.len);
+			if(ast->commands.len != 0)
+				fprintf(fp, "c%zu", id);
+			else
+				fprintf(fp, "NULL");
+			fprintf(fp, ", NULL, ");
+			print_layout_ref(g, ast->commands.layout);
+			fprintf(fp, ", &r%zu}", id);
+			break;
+		case W_AST_INDEX:
+			fprintf(fp, ", .index = {&n%zu[0], &n%zu[1]}", id, id);
+			break;
+	}
+	fprintf(fp, "}");
+}
+
+void w_cgen(w_ast_t *ast, FILE *fp) {
+	cgen_t g = (cgen_t){fp, ast->pos.filename != NULL ? ast->pos.filename : "", 0, NULL, 0, 0};
+	fprintf(fp, "// Generated by wi --emit-c from %s. Link with every source file of wi except main.c.\n\n", g.filename);
+	fprintf(fp, "#include \"cgen.h\"\n\n");
+	fprintf(fp, "static char w_file[] = ");
+	print_string(fp, g.filename, strlen(g.filename));
+	fprintf(fp, ";\n");
+	collect_layouts(&g, ast);
+	print_layouts(&g);
+	size_t id = define(&g, ast);
+	fprintf(fp, "static w_ast_t program = ");
+	print_init(&g, ast, id);
+	fprintf(fp, ";\n");
+	if(g.layouts_len != 0) {
+		fprintf(fp, "static w_layout_t *layouts[] = {");
+		for(size_t i = 0; i < g.layouts_len; i++)
+			fprintf(fp, "%s&l%zu", i == 0 ? "" : ", ", i);
+		fprintf(fp, "};\n\n");
+		fprintf(fp, "int main(void) {\n\treturn w_cgen_main(&program, layouts, %zu);\n}\n", g.layouts_len);
+	}
+	else
+		fprintf(fp, "\nint main(void) {\n\treturn w_cgen_main(&program, NULL, 0);\n}\n");
+	free(g.layouts);
+}
+
+// frees what running the program attached to its static AST
+static void release(w_ast_t *ast) {
+	w_ast_unquicken(ast);
+	switch(ast->type) {
+		case W_AST_COMMANDS: {
+			w_ast_commands_t *cmds = &ast->commands;
+			for(size_t i = 0; i < cmds->len; i++) {
+				for(size_t j = 0; j < cmds->ptr[i].len; j++)
+					release(&cmds->ptr[i].ptr[j]);
+				free(cmds->ptr[i].ic);
+				cmds->ptr[i].ic = NULL;
+			}
+			if(cmds->chunk != NULL)
+				w_chunk_free(cmds->chunk);
+			cmds->chunk = NULL;
+			break;
+		}
+		case W_AST_INDEX:
+			release(ast->index.left);
+			release(ast->index.right);
+			break;
+		default:
+			break;
+	}
+}
+
+int w_cgen_main(w_ast_t *ast, w_layout_t **layouts, size_t layouts_len) {
+	for(size_t i = 0; i < layouts_len; i++) {
+		for(size_t j = 0; j < layouts[i]->len; j++) {
+			layouts[i]->syms[j] = w_intern(&layouts[i]->names[j]);
+			layouts[i]->bloom |= w_bloom(&layouts[i]->names[j]);
+		}
+	}
+	w_status_t status = W_INITIAL_STATUS;
+	w_ctx_t ctx = w_default_ctx(&status);
+	w_value_t val = w_eval(&ctx, ast);
+	int code = 0;
+	if(status.tag != W_STATUS_OK) {
+		w_error_print(status.err, stdout);
+		w_status_free(&status);
+		code = 2;
+	}
+	else
+		w_value_release(&val);
+	w_ctx_free(&ctx);
+	release(ast);
+	return code;
+}
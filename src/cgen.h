@@ -0,0 +1,76 @@
+/// Describes the C code generator behind --emit-c, and the support code the generated programs use
+
+#ifndef W_CGEN_H
+#define W_CGEN_H
+
+#include <stdio.h>
+
+#include "vm.h"
+
+/// Writes a C program equivalent to running ast. The program is linked against every source file of wi except main.c.
+/// The AST is written out as static data, so the program doesn't parse anything, and every block gets a w_native_t
+/// that runs its instructions without going through the interpreter loop.
+void w_cgen(w_ast_t *ast, FILE *fp);
+
+/// Runs a program written by w_cgen with a default context, the same way wi runs a file. layouts are the layouts of
+/// every block in ast, whose names get interned first. Returns the exit code.
+int w_cgen_main(w_ast_t *ast, w_layout_t **layouts, size_t layouts_len);
+
+// used by the generated code. each instruction I of the chunk is a label iI, and code is the chunk's instructions.
+
+/// Runs instruction I with its generic implementation, unwinding if it doesn't go on to the next instruction
+#define W_CGEN_OP(I, OP) \
+	if(w_vm_ops[OP](vm, &code[I]) != W_VM_NEXT) { \
+		vm->insn = &code[I]; \
+		return W_VM_UNWIND; \
+	}
+
+/// Same as W_CGEN_OP, for instructions that can jump to TARGET
+#define W_CGEN_BRANCH(I, OP, TARGET) \
+	switch(w_vm_ops[OP](vm, &code[I])) { \
+		case W_VM_NEXT: \
+			break; \
+		case W_VM_JUMP: \
+			goto TARGET; \
+		default: \
+			vm->insn = &code[I]; \
+			return W_VM_UNWIND; \
+	}
+
+/// Pushes an int
+#define W_CGEN_INT(V) (vm->stack[vm->sp++] = (w_value_t){.type = W_VALUE_INT, .int_ = (V)})
+
+/// Applies the C operator EXPR to the two ints on top of the stack, falling back on the generic implementation for anything else
+#define W_CGEN_BINARY(I, OP, EXPR) { \
+	w_value_t *left = &vm->stack[vm->sp-2], *right = &vm->stack[vm->sp-1]; \
+	if(left->type == W_VALUE_INT && right->type == W_VALUE_INT) { \
+		left->int_ = left->int_ EXPR right->int_; \
+		vm->sp--; \
+	} \
+	else W_CGEN_OP(I, OP) \
+}
+
+/// Pops an int and jumps to TARGET if it's 0, falling back on the generic implementation for anything else
+#define W_CGEN_JUMP_IF_NOT(I, TARGET) { \
+	w_value_t *v = &vm->stack[vm->sp-1]; \
+	if(v->type == W_VALUE_INT) { \
+		vm->sp--; \
+		if(v->int_ == 0) \
+			goto TARGET; \
+	} \
+	else W_CGEN_BRANCH(I, W_OP_JUMP_IF_NOT, TARGET) \
+}
+
+/// Takes a step from the budget and jumps back to TARGET, falling back on the generic implementation when the slice is empty
+#define W_CGEN_LOOP(I, TARGET) { \
+	w_budget_t *b = vm->budget; \
+	if(b == NULL) \
+		goto TARGET; \
+	if(b->slice > 0) { \
+		b->slice--; \
+		goto TARGET; \
+	} \
+	W_CGEN_BRANCH(I, W_OP_LOOP, TARGET) \
+}
+
+#endif
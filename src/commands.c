@@ -10,44 +10,70 @@
 #include "commands.h"
 #include "info.h"
 
-// arg checking macros
+// arg checking macros. LEN is args.len for lazy commands, and argc for strict ones.
 
-#define ARGS_NONE(NAME) \
-	if(args.len != 0) { \
+#define CHECK_NONE(LEN, NAME) \
+	if(LEN != 0) { \
 		w_status_err(ctx->status, w_error_new(pos, NAME " takes no arguments.")); \
 		return (w_value_t){}; \
 	}
 
-#define ARGS_EQUAL(NAME, AMT) \
-	if(args.len != AMT) { \
+#define CHECK_EQUAL(LEN, NAME, AMT) \
+	if(LEN != AMT) { \
 		w_status_err(ctx->status, w_error_new(pos, NAME " takes exactly " #AMT " arguments.")); \
 		return (w_value_t){}; \
 	}
 
-#define ARGS_GTE(NAME, AMT) \
-	if(args.len < AMT) { \
+#define CHECK_GTE(LEN, NAME, AMT) \
+	if(LEN < AMT) { \
 		w_status_err(ctx->status, w_error_new(pos, NAME " takes at least " #AMT " arguments.")); \
 		return (w_value_t){}; \
 	}
 
-#define ARGS_BETWEEN(NAME, MIN, MAX) \
-	if(args.len < MIN || args.len > MAX) { \
+#define CHECK_BETWEEN(LEN, NAME, MIN, MAX) \
+	if(LEN < MIN || LEN > MAX) { \
 		w_status_err(ctx->status, w_error_new(pos, NAME " takes between " #MIN " and " #MAX " arguments.")); \
 		return (w_value_t){}; \
 	}
 
+#define ARGS_NONE(NAME) CHECK_NONE(args.len, NAME)
+#define ARGS_EQUAL(NAME, AMT) CHECK_EQUAL(args.len, NAME, AMT)
+#define ARGS_GTE(NAME, AMT) CHECK_GTE(args.len, NAME, AMT)
+#define ARGS_BETWEEN(NAME, MIN, MAX) CHECK_BETWEEN(args.len, NAME, MIN, MAX)
+
+#define ARGV_NONE(NAME) CHECK_NONE(argc, NAME)
+#define ARGV_EQUAL(NAME, AMT) CHECK_EQUAL(argc, NAME, AMT)
+#define ARGV_GTE(NAME, AMT) CHECK_GTE(argc, NAME, AMT)
+#define ARGV_BETWEEN(NAME, MIN, MAX) CHECK_BETWEEN(argc, NAME, MIN, MAX)
+
+// position of a strict command's argument, or of the command if the arguments didn't come from ASTs
+#define ARG_POS(IDX) (asts != NULL ? asts[IDX].pos : pos)
+
+// gets an argument of a strict command as a string, which must be released
 #define GET_STRING(RET, IDX) \
-	{ \
-		w_value_t _v = w_evalt(ctx, this, &args.ptr[IDX]); \
-		if(ctx->status->tag != W_STATUS_OK) \
-			return (w_value_t){}; \
-		if(_v.type == W_VALUE_STRING) \
-			RET = _v; \
-		else { \
-			RET = w_value_tostring(&_v); \
-			w_value_release(&_v); \
-		} \
-	}
+	if(argv[IDX].type == W_VALUE_STRING) { \
+		RET = argv[IDX]; \
+		w_value_ref(&RET); \
+	} \
+	else \
+		RET = w_value_tostring(&argv[IDX]);
+
+// gets an int argument of a strict command
+#define GET_INT(RET, IDX) { \
+	w_value_t *x = &argv[IDX]; \
+	if(x->type != W_VALUE_INT) { \
+		w_status_err(ctx->status, w_error_new(ARG_POS(0), "Expected int, got %s.", w_typename(x->type))); \
+		return (w_value_t){}; \
+	} \
+	RET = x->int_; \
+}
+
+// takes over an argument of a strict command, leaving null in its place so that the caller doesn't release it
+static w_value_t take(w_value_t *arg) {
+	w_value_t v = *arg;
+	*arg = (w_value_t){.type = W_VALUE_NULL};
+	return v;
+}
 
 // IO
 
@@ -72,20 +98,18 @@ W_COMMAND(w_cmd_echoln) {
 	return val;
 }
 
-W_COMMAND(w_cmd_read) {
-	ARGS_BETWEEN("read", 0, 1);
+W_STRICT(w_cmd_read) {
+	ARGV_BETWEEN("read", 0, 1);
 	w_writer_t w = w_writer_new();
 	FILE *fp = stdin;
-	if(args.len == 1) {
-		w_value_t v_ = w_evalt(ctx, this, &args.ptr[0]);
-		w_value_t v = w_value_tostring(&v_);
-		w_value_release(&v_);
-		if(ctx->status->tag != W_STATUS_OK)
-			return (w_value_t){};
+	if(argc == 1) {
+		w_value_t v = w_value_tostring(&argv[0]);
 		char *str = w_cstring(v.string);
 		fp = fopen(str, "r");
 		if(fp == NULL) {
 			w_status_err(ctx->status, w_error_new(pos, "Could not open file '%s'.", str));
+			w_value_release(&v);
+			free(w.buf);
 			free(str);
 			return (w_value_t){};
 		}
@@ -98,13 +122,13 @@ W_COMMAND(w_cmd_read) {
 	w_writer_resize(&w);
 	w_string_t *str = malloc(sizeof(w_string_t));
 	*str = (w_string_t){1, w.len, w.buf};
-	if(args.len == 1)
+	if(argc == 1)
 		fclose(fp);
 	return (w_value_t){.type = W_VALUE_STRING, .string = str};
 }
 
-W_COMMAND(w_cmd_write) {
-	ARGS_EQUAL("write", 2);
+W_STRICT(w_cmd_write) {
+	ARGV_EQUAL("write", 2);
 	w_value_t vname, vtext;
 	GET_STRING(vname, 0);
 	GET_STRING(vtext, 1);
@@ -150,26 +174,22 @@ W_COMMAND(w_cmd_readln) {
 
 // ops
 
-#define OP_CMD(OP) W_COMMAND(w_cmd_##OP) { \
-	ARGS_GTE(#OP, 1); \
-	w_value_t acc = w_evalt(ctx, this, &args.ptr[0]); \
-	if(ctx->status->tag != W_STATUS_OK) \
-		return (w_value_t){}; \
-	for(size_t i = 1; i < args.len; i++) { \
-		w_value_t v = w_evalt(ctx, this, &args.ptr[i]); \
-		if(ctx->status->tag != W_STATUS_OK) { \
+#define OP_CMD(OP) W_STRICT(w_cmd_##OP) { \
+	ARGV_GTE(#OP, 1); \
+	/* the arguments may be borrowed, so the first one is only referenced if it's the result */ \
+	w_value_t acc = argv[0]; \
+	for(size_t i = 1; i < argc; i++) { \
+		w_value_t n = w_value_##OP(ctx, &acc, &argv[i]); \
+		if(i > 1) \
 			w_value_release(&acc); \
-			return (w_value_t){}; \
-		} \
-		w_value_t n = w_value_##OP(ctx, &acc, &v); \
-		w_value_release(&v); \
-		w_value_release(&acc); \
 		if(ctx->status->tag != W_STATUS_OK) { \
 			ctx->status->err->pos = pos; \
 			return (w_value_t){}; \
 		} \
 		acc = n; \
 	} \
+	if(argc == 1) \
+		w_value_ref(&acc); \
 	return acc; \
 }
 
@@ -206,14 +226,9 @@ W_COMMAND(w_cmd_and) {
 // type conversions
 
 #define TYPE_CMD(NAME, FUNC) \
-	W_COMMAND(w_cmd_##NAME) { \
-		ARGS_EQUAL(#NAME, 1); \
-		w_value_t v = w_evalt(ctx, this, &args.ptr[0]); \
-		w_value_t ret = FUNC(&v); \
-		w_value_release(&v); \
-		if(ctx->status->tag != W_STATUS_OK) \
-			return (w_value_t){}; \
-		return ret; \
+	W_STRICT(w_cmd_##NAME) { \
+		ARGV_EQUAL(#NAME, 1); \
+		return FUNC(&argv[0]); \
 	}
 
 TYPE_CMD(int, w_value_toint);
@@ -224,7 +239,25 @@ TYPE_CMD(string, w_value_tostring);
 
 // context manipulation
 
-#define VAR_CMD(NAME, CMDNAME, FN) \
+// finds the variable value reads for the last time before set! overwrites var with it, as in set! $l [$l:push 1]. value has to be a
+// block that only calls a member of var and doesn't declare anything, so that the variable it reads is the one being set. returns
+// NULL if there isn't one.
+static w_ast_t *last_read(w_ast_t *var, w_ast_t *value) {
+	if(value->type != W_AST_COMMANDS || value->commands.len != 1)
+		return NULL;
+	w_layout_t *layout = value->commands.layout;
+	if(layout != NULL && layout->len != 0)
+		return NULL;
+	w_ast_t *name = &value->commands.ptr[0].ptr[0];
+	if(name->type != W_AST_INDEX || name->index.right->type != W_AST_STRING)
+		return NULL;
+	w_ast_t *left = name->index.left;
+	if(left->type != W_AST_VAR || !w_astreq(&left->string, &var->string) || w_astreqc(&left->string, "this"))
+		return NULL;
+	return left;
+}
+
+#define VAR_CMD(NAME, CMDNAME, FN, MOVE) \
 	W_COMMAND(w_cmd_##NAME) { \
 		ARGS_GTE(CMDNAME, 2); \
 		if(args.len%2 != 0) { \
@@ -238,10 +271,19 @@ TYPE_CMD(string, w_value_tostring);
 				w_status_err(ctx->status, w_error_new(pos, CMDNAME " can only bind variables.")); \
 				return (w_value_t){}; \
 			} \
+			/* the call can move the variable's value out of it instead of sharing it (see w_ecmd_invoke) */ \
+			w_ast_t *last = MOVE ? last_read(var, &args.ptr[i+1]) : NULL; \
+			bool was = false; \
+			if(last != NULL) { \
+				was = last->last; \
+				last->last = true; \
+			} \
 			v = w_evalt(ctx, this, &args.ptr[i+1]); \
+			if(last != NULL) \
+				last->last = was; \
 			if(ctx->status->tag != W_STATUS_OK) \
 				return (w_value_t){}; \
-			FN(ctx, &var->string, v); \
+			FN(ctx, var, v); \
 			if(ctx->status->tag != W_STATUS_OK) { \
 				ctx->status->err->pos = pos; \
 				return (w_value_t){}; \
@@ -251,8 +293,8 @@ TYPE_CMD(string, w_value_tostring);
 		return v; \
 	}
 
-VAR_CMD(set, "set!", w_ctx_set);
-VAR_CMD(let, "let!", w_ctx_let);
+VAR_CMD(set, "set!", w_ctx_set_var, true);
+VAR_CMD(let, "let!", w_ctx_let_var, false);
 
 #undef VAR_CMD
 
@@ -277,63 +319,35 @@ W_COMMAND(w_cmd_swap) {
 		w_status_err(ctx->status, w_error_new(pos, "swap! can only operate on variables."));
 		return (w_value_t){};
 	}
-	w_value_t *va = w_ctx_get(ctx, &a->string);
-	w_value_t *vb = w_ctx_get(ctx, &b->string);
+	w_value_t *va = w_ctx_get_var(ctx, a);
+	w_value_t *vb = w_ctx_get_var(ctx, b);
 	w_value_t tmp = *vb;
 	*vb = *va;
 	*va = tmp;
+	w_ctx_changed(&a->string);
+	w_ctx_changed(&b->string);
 	return (w_value_t){.type = W_VALUE_NULL};
 }
 
 // boolean ops
 
-W_COMMAND(w_cmd_equ) {
-	ARGS_EQUAL("=", 2);
-	w_value_t a = w_evalt(ctx, this, &args.ptr[0]);
-	if(ctx->status->tag != W_STATUS_OK)
-		return (w_value_t){};
-	w_value_t b = w_evalt(ctx, this, &args.ptr[1]);
-	if(ctx->status->tag != W_STATUS_OK) {
-		w_value_release(&a);
-		return (w_value_t){};
-	}
-	bool ret = w_value_equal(&a, &b);
-	w_value_release(&a);
-	w_value_release(&b);
+W_STRICT(w_cmd_equ) {
+	ARGV_EQUAL("=", 2);
+	bool ret = w_value_equal(&argv[0], &argv[1]);
 	return (w_value_t){.type = W_VALUE_INT, .int_ = ret ? 1 : 0};
 }
 
-W_COMMAND(w_cmd_neq) {
-	ARGS_EQUAL("!=", 2);
-	w_value_t a = w_evalt(ctx, this, &args.ptr[0]);
-	if(ctx->status->tag != W_STATUS_OK)
-		return (w_value_t){};
-	w_value_t b = w_evalt(ctx, this, &args.ptr[1]);
-	if(ctx->status->tag != W_STATUS_OK) {
-		w_value_release(&a);
-		return (w_value_t){};
-	}
-	bool ret = !w_value_equal(&a, &b);
-	w_value_release(&a);
-	w_value_release(&b);
+W_STRICT(w_cmd_neq) {
+	ARGV_EQUAL("!=", 2);
+	bool ret = !w_value_equal(&argv[0], &argv[1]);
 	return (w_value_t){.type = W_VALUE_INT, .int_ = ret ? 1 : 0};
 }
 
 
 // can't use this for the earlier ones because lt, lte, gt, and gte all use ctx, while equals doesn't. this means a lot of code repition which is bad and I should fix it.
-#define BOOL_CMD(OP, NAME) W_COMMAND(w_cmd_##OP) { \
-	ARGS_EQUAL(#NAME, 2); \
-	w_value_t a = w_evalt(ctx, this, &args.ptr[0]); \
-	if(ctx->status->tag != W_STATUS_OK) \
-		return (w_value_t){}; \
-	w_value_t b = w_evalt(ctx, this, &args.ptr[1]); \
-	if(ctx->status->tag != W_STATUS_OK) { \
-		w_value_release(&a); \
-		return (w_value_t){}; \
-	} \
-	bool ret = w_value_##OP(ctx, &a, &b); \
-	w_value_release(&a); \
-	w_value_release(&b); \
+#define BOOL_CMD(OP, NAME) W_STRICT(w_cmd_##OP) { \
+	ARGV_EQUAL(#NAME, 2); \
+	bool ret = w_value_##OP(ctx, &argv[0], &argv[1]); \
 	return (w_value_t){.type = W_VALUE_INT, .int_ = ret ? 1 : 0}; \
 }
 
@@ -388,7 +402,6 @@ W_COMMAND(w_cmd_return) {
 	else
 		val = (w_value_t){.type = W_VALUE_NULL};
 	w_status_return(ctx->status, &val);
-	w_value_release(&val);
 	return (w_value_t){};
 }
 
@@ -398,15 +411,22 @@ W_COMMAND(w_cmd_while) {
 	w_ast_t *body = &args.ptr[1];
 	w_value_t vbody = (w_value_t){.type = W_VALUE_NULL};
 	while(true) {
-		w_value_release(&vbody);
+		if(!w_step(ctx, pos)) {
+			w_value_release(&vbody);
+			return (w_value_t){};
+		}
 		w_value_t vcond = w_evalt(ctx, this, cond);
-		if(ctx->status->tag != W_STATUS_OK)
+		if(ctx->status->tag != W_STATUS_OK) {
+			w_value_release(&vbody);
 			return (w_value_t){};
+		}
 		if(!w_value_truthy(&vcond)) {
 			w_value_release(&vcond);
 			break;
 		}
 		w_value_release(&vcond);
+		// the last body's value is kept until here, since it's what the loop returns if this is the last iteration
+		w_value_release(&vbody);
 		vbody = w_evalt(ctx, this, body);
 		switch(ctx->status->tag) {
 			case W_STATUS_OK:
@@ -437,13 +457,18 @@ W_COMMAND(w_cmd_for) {
 	w_value_t coll = w_evalt(ctx, this, &args.ptr[args.len-2]);
 	if(ctx->status->tag != W_STATUS_OK)
 		return (w_value_t){};
-	w_astring_t *idx = NULL, *elem = NULL;
+	return w_for(ctx, this, coll, args);
+}
+
+w_value_t w_for(w_ctx_t *ctx, w_value_t *this, w_value_t coll, w_args_t args) {
+	w_ast_t *idx = NULL, *elem = NULL;
 	#define GET_VAR(NAME, IDX) \
 		if(args.ptr[IDX].type != W_AST_VAR) { \
 			w_status_err(ctx->status, w_error_new(args.ptr[IDX].pos, "Argument " #IDX " must be a variable.")); \
+			w_value_release(&coll); \
 			return (w_value_t){}; \
 		} \
-		NAME = &args.ptr[IDX].string;
+		NAME = &args.ptr[IDX];
 	switch(args.len) {
 		case 3:
 			GET_VAR(elem, 0);
@@ -455,19 +480,24 @@ W_COMMAND(w_cmd_for) {
 	}
 	#undef GET_VAR
 	w_ast_t *body = &args.ptr[args.len-1];
+	w_layout_t *layout = body->type == W_AST_COMMANDS ? body->commands.layout : NULL;
 	w_value_t v = (w_value_t){.type = W_VALUE_NULL};
 	if(coll.type == W_VALUE_LIST) {
 		w_list_t *l = coll.list;
 		for(size_t i = 0; i < l->len; i++) {
-			w_ctx_t sub = w_ctx_clone(ctx); // this creates a context for every iteration, which is probably suboptimal. however, in order to just have one, I'd need a way
-																			// of tracking which variables aren't created by the command in order to delete them after every iteration. so I'll keep this for now.
+			if(!w_step(ctx, body->pos)) {
+				w_value_release(&v);
+				w_value_release(&coll);
+				return (w_value_t){};
+			}
+			w_ctx_t sub = w_ctx_enter(ctx, layout); // this creates a context for every iteration. that's cheap, since frames are reused.
 			w_value_release(&v);
 			if(elem != NULL) {
 				w_value_t item = l->ptr[i];
 				w_value_ref(&item);
-				w_ctx_let(&sub, elem, item);
+				w_ctx_let_var(&sub, elem, item);
 				if(idx != NULL)
-					w_ctx_let(&sub, idx, (w_value_t){.type = W_VALUE_INT, .int_ = i});
+					w_ctx_let_var(&sub, idx, (w_value_t){.type = W_VALUE_INT, .int_ = i});
 			}
 			v = w_evalst(ctx, &sub, this, body);
 			switch(ctx->status->tag) {
@@ -493,42 +523,45 @@ W_COMMAND(w_cmd_for) {
 		return v;
 	}
 	if(coll.type == W_VALUE_MAP) {
-		w_map_t *map = coll.map;
-		for(size_t i = 0; i < map->capacity; i++) {
-			w_map_list_t *curr = map->ptr[i];
-			while(curr != NULL) {
-				w_ctx_t sub = w_ctx_clone(ctx); 
+		w_map_iter_t it = {};
+		w_astring_t *key;
+		w_value_t *item;
+		while(w_map_next(coll.map, &it, &key, &item)) {
+			if(!w_step(ctx, body->pos)) {
 				w_value_release(&v);
-				if(elem != NULL) {
-					w_value_ref(&curr->item);
-					w_ctx_let(&sub, elem, curr->item);
-					if(idx != NULL) {
-						w_astring_t s = w_astrdup(&curr->key);
-						w_string_t *str = malloc(sizeof(w_string_t));
-						*str = (w_string_t){1, s.len, s.ptr};
-						w_ctx_let(&sub, idx, (w_value_t){.type = W_VALUE_STRING, .string = str});
-					}
-				}
-				v = w_evalst(ctx, &sub, this, body);
-				switch(ctx->status->tag) {
-					case W_STATUS_OK:
-						break;
-					case W_STATUS_BREAK:
-						w_ctx_free(&sub);
-						w_status_ok(ctx->status);
-						goto map_done;
-					case W_STATUS_CONTINUE:
-						w_status_ok(ctx->status);
-						goto map_cont;
-					default:
-						w_value_release(&coll);
-						w_ctx_free(&sub);
-						return (w_value_t){};
+				w_value_release(&coll);
+				return (w_value_t){};
+			}
+			w_ctx_t sub = w_ctx_enter(ctx, layout);
+			w_value_release(&v);
+			if(elem != NULL) {
+				w_value_ref(item);
+				w_ctx_let_var(&sub, elem, *item);
+				if(idx != NULL) {
+					w_astring_t s = w_astrdup(key);
+					w_string_t *str = malloc(sizeof(w_string_t));
+					*str = (w_string_t){1, s.len, s.ptr};
+					w_ctx_let_var(&sub, idx, (w_value_t){.type = W_VALUE_STRING, .string = str});
 				}
-				map_cont:
-				w_ctx_free(&sub);
-				curr = curr->next;
 			}
+			v = w_evalst(ctx, &sub, this, body);
+			switch(ctx->status->tag) {
+				case W_STATUS_OK:
+					break;
+				case W_STATUS_BREAK:
+					w_ctx_free(&sub);
+					w_status_ok(ctx->status);
+					goto map_done;
+				case W_STATUS_CONTINUE:
+					w_status_ok(ctx->status);
+					goto map_cont;
+				default:
+					w_value_release(&coll);
+					w_ctx_free(&sub);
+					return (w_value_t){};
+			}
+			map_cont:
+			w_ctx_free(&sub);
 		}
 		map_done:
 		w_value_release(&coll);
@@ -541,41 +574,19 @@ W_COMMAND(w_cmd_for) {
 
 // structures
 
-W_COMMAND(w_cmd_list) {
+W_STRICT(w_cmd_list) {
 	w_list_t *l = malloc(sizeof(w_list_t));
-	*l = (w_list_t){1, args.len, malloc(sizeof(w_value_t)*args.len)};
-	for(size_t i = 0; i < args.len; i++) {
-		w_value_t v = w_evalt(ctx, this, &args.ptr[i]);
-		if(ctx->status->tag != W_STATUS_OK) {
-			for(size_t j = 0; j < i; j++)
-				w_value_release(&l->ptr[j]);
-			free(l->ptr);
-			return (w_value_t){};
-		}
-		l->ptr[i] = v;
-	}
+	*l = (w_list_t){1, argc, malloc(sizeof(w_value_t)*argc)};
+	for(size_t i = 0; i < argc; i++)
+		l->ptr[i] = take(&argv[i]);
 	return (w_value_t){.type = W_VALUE_LIST, .list = l};
 }
 
-
-// gets an integer
-#define GET_INT(RET, IDX) { \
-	w_value_t x = w_evalt(ctx, this, &args.ptr[IDX]); \
-	if(ctx->status->tag != W_STATUS_OK) \
-		return (w_value_t){}; \
-	if(x.type != W_VALUE_INT) { \
-		w_status_err(ctx->status, w_error_new(args.ptr[0].pos, "Expected int, got %s.", w_typename(x.type))); \
-		w_value_release(&x); \
-		return (w_value_t){}; \
-	} \
-	RET = x.int_; \
-}
-
-W_COMMAND(w_cmd_range) {
-	ARGS_BETWEEN("range", 1, 2);
+W_STRICT(w_cmd_range) {
+	ARGV_BETWEEN("range", 1, 2);
 	int64_t min, max;
 		
-	if(args.len == 1) {
+	if(argc == 1) {
 		min = 0;
 		GET_INT(max, 0);
 	}
@@ -605,37 +616,17 @@ W_COMMAND(w_cmd_range) {
 	return (w_value_t){.type = W_VALUE_LIST, .list = l};
 }
 
-W_COMMAND(w_cmd_map) {
-	if(args.len%2 != 0) {
+W_STRICT(w_cmd_map) {
+	if(argc%2 != 0) {
 		w_status_err(ctx->status, w_error_new(pos, "map must have an even amount of arguments."));
 		return (w_value_t){};
 	}
-	w_map_t *map = malloc(sizeof(w_map_t));
-	*map = w_map_new(128, 1);
+	w_map_t *map = w_map_new();
 	w_value_t vmap = (w_value_t){.type = W_VALUE_MAP, .map = map};
-	for(size_t i = 0; i < args.len; i += 2) {
+	for(size_t i = 0; i < argc; i += 2) {
 		w_value_t key;
-		{
-			w_value_t vkey = w_evalt(ctx, this, &args.ptr[i]);
-			if(ctx->status->tag != W_STATUS_OK) {
-				w_map_free(map);
-				free(map);
-				return (w_value_t){};
-			}
-			if(vkey.type != W_VALUE_STRING) {
-				key = w_value_tostring(&vkey);
-				w_value_release(&vkey);
-			}
-			else
-				key = vkey;
-		}
-		w_value_t value = w_evalt(ctx, this, &args.ptr[i+1]);
-		if(ctx->status->tag != W_STATUS_OK) {
-			w_map_free(map);
-			free(map);
-			w_value_release(&key);
-			return (w_value_t){};
-		}
+		GET_STRING(key, i);
+		w_value_t value = take(&argv[i+1]);
 		// set $this pointer if value is a command and doesn't already have $this set
 		if(value.type == W_VALUE_COMMAND) {
 			// modify in-place if this is the only reference, otherwise clone and modify
@@ -647,71 +638,63 @@ W_COMMAND(w_cmd_map) {
 			value.cmd->this = malloc(sizeof(w_value_t));
 			*value.cmd->this = vmap;
 		}
-		w_astring_t str = (w_astring_t){key.string->len, key.string->ptr};
+		w_astring_t str = w_string_key(key.string);
 		w_map_set(map, &str, value);
 		w_value_release(&key);
 	}
 	return vmap;
 }
 
-W_COMMAND(w_cmd_refcount) {
-	ARGS_EQUAL("refcount", 1);
-	w_value_t v = w_evalt(ctx, this, &args.ptr[0]);
+W_STRICT(w_cmd_refcount) {
+	ARGV_EQUAL("refcount", 1);
+	w_value_t *v = &argv[0];
 	int64_t refcount = 0;
-	switch(v.type) {
+	switch(v->type) {
 		case W_VALUE_STRING:
-			refcount = v.string->refcount;
+			refcount = v->string->refcount;
 			break;
 		case W_VALUE_LIST:
-			refcount = v.list->refcount;
+			refcount = v->list->refcount;
 			break;
 		case W_VALUE_MAP:
-			refcount = v.map->data;
+			refcount = v->map->refcount;
 			break;
 		case W_VALUE_EXTERNCMD:
-			refcount = v.externcmd->refcount;
+			refcount = v->externcmd->refcount;
 			break;
 		case W_VALUE_COMMAND:
-			refcount = v.cmd->refcount;
+			refcount = v->cmd->refcount;
 			break;
 	}
-	w_value_release(&v);
-	// -1 on refcount since we're creating a new reference by evalling a thing that returns the object
+	// -1 on refcount since the argument is a new reference to the object
 	return (w_value_t){.type = W_VALUE_INT, .int_ = refcount-1};
 }
 
-W_COMMAND(w_cmd_list_set_mut) {
-	ARGS_EQUAL("list:set", 2);
+W_STRICT(w_cmd_list_set_mut) {
+	ARGV_EQUAL("list:set", 2);
 	w_list_t *l = obj->list;
-	w_value_t vidx = w_evalt(ctx, this, &args.ptr[0]);
-	if(ctx->status->tag != W_STATUS_OK)
-		return (w_value_t){};
-	if(vidx.type != W_VALUE_INT) {
-		w_value_release(&vidx);
-		w_status_err(ctx->status, w_error_new(args.ptr[0].pos, "Index must be an int."));
+	if(argv[0].type != W_VALUE_INT) {
+		w_status_err(ctx->status, w_error_new(ARG_POS(0), "Index must be an int."));
 		return (w_value_t){};
 	}
-	int64_t idx = vidx.int_;
+	int64_t idx = argv[0].int_;
 	if(idx < 0 || idx >= l->len) {
-		w_status_err(ctx->status, w_error_new(args.ptr[0].pos, "Index %" PRId64 " out of bounds for array of length %zu.", idx, l->len));
+		w_status_err(ctx->status, w_error_new(ARG_POS(0), "Index %" PRId64 " out of bounds for array of length %zu.", idx, l->len));
 		return (w_value_t){};
 	}
-	w_value_t val = w_evalt(ctx, this, &args.ptr[1]);
-	if(ctx->status->tag != W_STATUS_OK)
-		return (w_value_t){};
 	w_value_release(&l->ptr[idx]);
-	l->ptr[idx] = val;
+	l->ptr[idx] = take(&argv[1]);
 	w_value_ref(obj);
 	return *obj;
 }
 
 // macro to create a non-mutating version of another command
 #define UNMUT(NAME, MUT, REFCOUNT) \
-	W_COMMAND(NAME) { \
+	W_STRICT(NAME) { \
 		if(obj->REFCOUNT == 1) /* if there's only one reference, we can safely do the operation in-place */ \
-			return MUT(pos, ctx, this, obj, args); \
+			return MUT(pos, ctx, obj, argc, argv, asts); \
 		w_value_t new = w_value_clone(obj); \
-		w_value_t v = MUT(pos, ctx, this, &new, args); \
+		w_value_t v = MUT(pos, ctx, &new, argc, argv, asts); \
 		if(ctx->status->tag != W_STATUS_OK) { \
 			w_value_release(&new); \
 			return (w_value_t){}; \
@@ -722,65 +705,35 @@ W_COMMAND(w_cmd_list_set_mut) {
 
 UNMUT(w_cmd_list_set, w_cmd_list_set_mut, list->refcount);
 
-W_COMMAND(w_cmd_list_push_mut) {
-	ARGS_GTE("list:push", 1);
+W_STRICT(w_cmd_list_push_mut) {
+	ARGV_GTE("list:push", 1);
 	w_list_t *l = obj->list;
-	size_t prevlen = l->len;
-	l->len += args.len;
-	l->ptr = realloc(l->ptr, sizeof(w_value_t)*l->len);
-	for(size_t i = 0; i < args.len; i++) {
-		w_value_t v = w_evalt(ctx, this, &args.ptr[i]);
-		if(ctx->status->tag != W_STATUS_OK) {
-			for(size_t j = 0; j < i; j++)
-				w_value_release(&l->ptr[prevlen+j]);
-			l->len = prevlen;
-			if(l->len == 0)
-				free(l->ptr);
-			else
-				l->ptr = realloc(l->ptr, sizeof(w_value_t)*prevlen);
-			return (w_value_t){};
-		}
-		l->ptr[prevlen+i] = v;
-	}
+	l->ptr = realloc(l->ptr, sizeof(w_value_t)*(l->len+argc));
+	for(size_t i = 0; i < argc; i++)
+		l->ptr[l->len+i] = take(&argv[i]);
+	l->len += argc;
 	w_value_ref(obj);
 	return *obj;
 }
 
 UNMUT(w_cmd_list_push, w_cmd_list_push_mut, list->refcount);
 
-// maybe I should make a macro to generalize this and list:push
-// TODO
-
-W_COMMAND(w_cmd_list_unshift_mut) {
-	ARGS_GTE("list:unshift", 1);
+W_STRICT(w_cmd_list_unshift_mut) {
+	ARGV_GTE("list:unshift", 1);
 	w_list_t *l = obj->list;
-	size_t prevlen = l->len;
-	l->len += args.len;
-	l->ptr = realloc(l->ptr, sizeof(w_value_t)*l->len);
-	memmove(l->ptr+args.len, l->ptr, sizeof(w_value_t)*prevlen);
-	for(size_t i = 0; i < args.len; i++) {
-		w_value_t v = w_evalt(ctx, this, &args.ptr[i]);
-		if(ctx->status->tag != W_STATUS_OK) {
-			for(size_t j = 0; j < i; j++)
-				w_value_release(&l->ptr[i]);
-			memmove(l->ptr, l->ptr+args.len, sizeof(w_value_t)*prevlen);
-			l->len = prevlen;
-			if(l->len == 0)
-				free(l->ptr);
-			else
-				l->ptr = realloc(l->ptr, sizeof(w_value_t)*prevlen);
-			return (w_value_t){};
-		}
-		l->ptr[i] = v;
-	}
+	l->ptr = realloc(l->ptr, sizeof(w_value_t)*(l->len+argc));
+	memmove(l->ptr+argc, l->ptr, sizeof(w_value_t)*l->len);
+	for(size_t i = 0; i < argc; i++)
+		l->ptr[i] = take(&argv[i]);
+	l->len += argc;
 	w_value_ref(obj);
 	return *obj;
 }
 
 UNMUT(w_cmd_list_unshift, w_cmd_list_unshift_mut, list->refcount);
 
-W_COMMAND(w_cmd_list_pop_mut) {
-	ARGS_NONE("list:pop");
+W_STRICT(w_cmd_list_pop_mut) {
+	ARGV_NONE("list:pop");
 	w_list_t *l = obj->list;
 	w_value_t v = l->ptr[l->len-1];
 	l->ptr = realloc(l->ptr, sizeof(w_value_t)*(--l->len));
@@ -789,8 +742,8 @@ W_COMMAND(w_cmd_list_pop_mut) {
 
 UNMUT(w_cmd_list_pop, w_cmd_list_pop_mut, list->refcount);
 
-W_COMMAND(w_cmd_list_shift_mut) {
-	ARGS_NONE("list:shift");
+W_STRICT(w_cmd_list_shift_mut) {
+	ARGV_NONE("list:shift");
 	w_list_t *l = obj->list;
 	w_value_t v = l->ptr[0];
 	memmove(l->ptr, l->ptr+1, sizeof(w_value_t)*(--l->len));
@@ -800,8 +753,8 @@ W_COMMAND(w_cmd_list_shift_mut) {
 
 UNMUT(w_cmd_list_shift, w_cmd_list_shift_mut, list->refcount);
 
-W_COMMAND(w_cmd_list_slice_mut) {
-	ARGS_EQUAL("list:slice", 2);
+W_STRICT(w_cmd_list_slice_mut) {
+	ARGV_EQUAL("list:slice", 2);
 	uint64_t start, end;
 	GET_INT(start, 0);
 	GET_INT(end, 1);
@@ -834,24 +787,22 @@ W_COMMAND(w_cmd_list_slice_mut) {
 
 UNMUT(w_cmd_list_slice, w_cmd_list_slice_mut, list->refcount);
 
-W_COMMAND(w_cmd_list_cat_mut) {
-	ARGS_GTE("list:cat", 1);
+W_STRICT(w_cmd_list_cat_mut) {
+	ARGV_GTE("list:cat", 1);
 	w_list_t *l = obj->list;
-	for(size_t i = 0; i < args.len; i++) {
-		w_value_t v = w_evalt(ctx, this, &args.ptr[i]);
-		if(v.type != W_VALUE_LIST) {
-			w_value_release(&v);
-			w_status_err(ctx->status, w_error_new(pos, "list expected, got %s.", w_typename(v.type)));
+	for(size_t i = 0; i < argc; i++) {
+		w_value_t *v = &argv[i];
+		if(v->type != W_VALUE_LIST) {
+			w_status_err(ctx->status, w_error_new(pos, "list expected, got %s.", w_typename(v->type)));
 			return (w_value_t){};
 		}
-		w_list_t *list = v.list;
+		w_list_t *list = v->list;
 		for(size_t i = 0; i < list->len; i++)
 			w_value_ref(&list->ptr[i]);
 		size_t prevlen = l->len;
 		l->len += list->len;
 		l->ptr = realloc(l->ptr, sizeof(w_value_t)*l->len);
 		memcpy(&l->ptr[prevlen], list->ptr, sizeof(w_value_t)*list->len);
-		w_value_release(&v);
 	}
 	w_value_ref(obj);
 	return *obj;
@@ -859,26 +810,22 @@ W_COMMAND(w_cmd_list_cat_mut) {
 
 UNMUT(w_cmd_list_cat, w_cmd_list_cat_mut, list->refcount);
 
-W_COMMAND(w_cmd_list_fill_mut) {
-	ARGS_EQUAL("list:fill", 1);
-	w_value_t v = w_evalt(ctx, this, &args.ptr[0]);
-	if(ctx->status->tag != W_STATUS_OK)
-		return (w_value_t){};
+W_STRICT(w_cmd_list_fill_mut) {
+	ARGV_EQUAL("list:fill", 1);
 	w_list_t *l = obj->list;
 	for(size_t i = 0; i < l->len; i++) {
 		w_value_release(&l->ptr[i]);
-		w_value_t clone = w_value_clone(&v);
+		w_value_t clone = w_value_clone(&argv[0]);
 		l->ptr[i] = clone;
 	}
-	w_value_release(&v);
 	w_value_ref(obj);
 	return *obj;
 }
 
-UNMUT(w_cmd_list_fill, w_cmd_list_fill_mut, map->data);
+UNMUT(w_cmd_list_fill, w_cmd_list_fill_mut, list->refcount);
 
-W_COMMAND(w_cmd_list_dup_mut) {
-	ARGS_EQUAL("list:dup", 1);
+W_STRICT(w_cmd_list_dup_mut) {
+	ARGV_EQUAL("list:dup", 1);
 	int64_t amt;
 	GET_INT(amt, 0);
 	if(amt < 0) {
@@ -909,8 +856,8 @@ W_COMMAND(w_cmd_list_dup_mut) {
 
 UNMUT(w_cmd_list_dup, w_cmd_list_dup_mut, list->refcount);
 
-W_COMMAND(w_cmd_list_reverse_mut) {
-	ARGS_EQUAL("list:reverse", 0);
+W_STRICT(w_cmd_list_reverse_mut) {
+	ARGV_EQUAL("list:reverse", 0);
 	w_list_t *l = obj->list;
 	for(size_t i = 0; i < l->len/2; i++) {
 		w_value_t tmp = l->ptr[i];
@@ -923,46 +870,27 @@ W_COMMAND(w_cmd_list_reverse_mut) {
 
 UNMUT(w_cmd_list_reverse, w_cmd_list_reverse_mut, list->refcount);
 
-W_COMMAND(w_cmd_map_set_mut) {
-	ARGS_EQUAL("map:set", 2);
+W_STRICT(w_cmd_map_set_mut) {
+	ARGV_EQUAL("map:set", 2);
 	w_map_t *map = obj->map;
 	w_value_t key;
-	{
-		w_value_t vkey = w_evalt(ctx, this, &args.ptr[0]);
-		if(ctx->status->tag != W_STATUS_OK)
-			return (w_value_t){};
-		if(vkey.type != W_VALUE_STRING) {
-			key = w_value_tostring(&vkey);
-			w_value_release(&vkey);
-		}
-		key = vkey;
-	}
-	w_value_t value = w_evalt(ctx, this, &args.ptr[1]);
-	if(ctx->status->tag != W_STATUS_OK) {
-		w_value_release(&key);
-		return (w_value_t){};
-	}
-	w_astring_t astr = (w_astring_t){key.string->len, key.string->ptr};
-	w_map_set(map, &astr, value);
+	GET_STRING(key, 0);
+	w_astring_t astr = w_string_key(key.string);
+	w_map_set(map, &astr, take(&argv[1]));
+	w_value_release(&key);
 	w_value_ref(obj);
 	return *obj;
 }
 
-UNMUT(w_cmd_map_set, w_cmd_map_set_mut, map->data);
+UNMUT(w_cmd_map_set, w_cmd_map_set_mut, map->refcount);
 
-W_COMMAND(w_cmd_map_del_mut) {
-	ARGS_GTE("map:del", 1);
+W_STRICT(w_cmd_map_del_mut) {
+	ARGV_GTE("map:del", 1);
 	w_map_t *map = obj->map;
-	for(size_t i = 0; i < args.len; i++) {
-		w_value_t v = w_evalt(ctx, this, &args.ptr[i]);
-		if(ctx->status->tag != W_STATUS_OK)
-			return (w_value_t){};
-		if(v.type != W_VALUE_STRING) {
-			w_value_t v2 = w_value_tostring(&v);
-			w_value_release(&v);
-			v = v2;
-		}
-		w_astring_t astr = (w_astring_t){v.string->len, v.string->ptr};
+	for(size_t i = 0; i < argc; i++) {
+		w_value_t v;
+		GET_STRING(v, i);
+		w_astring_t astr = w_string_key(v.string);
 		w_map_del(map, &astr);
 		w_value_release(&v);
 	}
@@ -970,14 +898,14 @@ W_COMMAND(w_cmd_map_del_mut) {
 	return *obj;
 }
 
-UNMUT(w_cmd_map_del, w_cmd_map_del_mut, map->data);
+UNMUT(w_cmd_map_del, w_cmd_map_del_mut, map->refcount);
 
-W_COMMAND(w_cmd_new_list) {
-	ARGS_EQUAL("new-list", 1);
+W_STRICT(w_cmd_new_list) {
+	ARGV_EQUAL("new-list", 1);
 	int64_t len;
 	GET_INT(len, 0);
 	if(len < 0) {
-		w_status_err(ctx->status, w_error_new(args.ptr[0].pos, "List length must be positive."));
+		w_status_err(ctx->status, w_error_new(ARG_POS(0), "List length must be positive."));
 		return (w_value_t){};
 	}
 	w_value_t *ptr = malloc(sizeof(w_value_t)*len);
@@ -988,8 +916,8 @@ W_COMMAND(w_cmd_new_list) {
 	return (w_value_t){.type = W_VALUE_LIST, .list = l};
 }
 
-W_COMMAND(w_cmd_string_slice_mut) {
-	ARGS_EQUAL("string:slice", 2);
+W_STRICT(w_cmd_string_slice_mut) {
+	ARGV_EQUAL("string:slice", 2);
 	int64_t start, end;
 	GET_INT(start, 0);
 	GET_INT(end, 1);
@@ -1008,21 +936,22 @@ W_COMMAND(w_cmd_string_slice_mut) {
 	}
 	size_t len = end-start;
 	s->len = len;
+	s->hash = 0;
 	if(len == 0) {
 		free(s->ptr);
 		s->ptr = NULL;
 		w_value_ref(obj);
 		return *obj;
 	}
-	memcpy(s->ptr, &s->ptr[start], len);
+	memmove(s->ptr, &s->ptr[start], len);
 	w_value_ref(obj);
 	return *obj;
 }
 
 UNMUT(w_cmd_string_slice, w_cmd_string_slice_mut, string->refcount);
 
-W_COMMAND(w_cmd_string_set_mut) {
-	ARGS_EQUAL("string:set", 2);
+W_STRICT(w_cmd_string_set_mut) {
+	ARGV_EQUAL("string:set", 2);
 	int64_t idx;
 	GET_INT(idx, 0);
 	w_string_t *s = obj->string;
@@ -1030,16 +959,17 @@ W_COMMAND(w_cmd_string_set_mut) {
 		w_status_err(ctx->status, w_error_new(pos, "Index %" PRId64 " is out of range for string of length %zu.", idx, s->len));
 		return (w_value_t){};
 	}
-	w_value_t v = w_evalt(ctx, this, &args.ptr[1]);
-	switch(v.type) {
+	s->hash = 0;
+	w_value_t *v = &argv[1];
+	switch(v->type) {
 		case W_VALUE_FLOAT:
-			s->ptr[idx] = (char)v.float_;
+			s->ptr[idx] = (char)v->float_;
 			break;
 		case W_VALUE_INT:
-			s->ptr[idx] = v.int_;
+			s->ptr[idx] = v->int_;
 			break;
 		case W_VALUE_STRING: {
-			w_string_t *str = v.string;
+			w_string_t *str = v->string;
 			if(str->len != 1) {
 				w_status_err(ctx->status, w_error_new(pos, "Value string must be of length 1."));
 				return (w_value_t){};
@@ -1048,7 +978,6 @@ W_COMMAND(w_cmd_string_set_mut) {
 			break;
 		}
 		default:
-			w_value_release(&v);
 			w_status_err(ctx->status, w_error_new(pos, "string:set takes 2 arguments"));
 			return (w_value_t){};
 	}
@@ -1058,8 +987,8 @@ W_COMMAND(w_cmd_string_set_mut) {
 
 UNMUT(w_cmd_string_set, w_cmd_string_set_mut, string->refcount);
 
-W_COMMAND(w_cmd_string_dup_mut) {
-	ARGS_EQUAL("string:dup", 1);
+W_STRICT(w_cmd_string_dup_mut) {
+	ARGV_EQUAL("string:dup", 1);
 	int64_t amt;
 	GET_INT(amt, 0);
 	if(amt < 0) {
@@ -1067,6 +996,7 @@ W_COMMAND(w_cmd_string_dup_mut) {
 		return (w_value_t){};
 	}
 	w_string_t *str = obj->string;
+	str->hash = 0;
 	if(amt == 0) {
 		str->len = 0;
 		free(str->ptr);
@@ -1088,9 +1018,10 @@ W_COMMAND(w_cmd_string_dup_mut) {
 
 UNMUT(w_cmd_string_dup, w_cmd_string_dup_mut, string->refcount);
 
-W_COMMAND(w_cmd_string_reverse_mut) {
-	ARGS_EQUAL("string:reverse", 0);
+W_STRICT(w_cmd_string_reverse_mut) {
+	ARGV_EQUAL("string:reverse", 0);
 	w_string_t *str = obj->string;
+	str->hash = 0;
 	for(size_t i = 0; i < str->len/2; i++) {
 		char tmp = str->ptr[i];
 		str->ptr[i] = str->ptr[str->len-i-1];
@@ -1102,16 +1033,13 @@ W_COMMAND(w_cmd_string_reverse_mut) {
 
 UNMUT(w_cmd_string_reverse, w_cmd_string_reverse_mut, string->refcount);
 
-W_COMMAND(w_cmd_string_cat_mut) {
-	ARGS_GTE("string:cat", 1);
+W_STRICT(w_cmd_string_cat_mut) {
+	ARGV_GTE("string:cat", 1);
 	w_string_t *str = obj->string;
-	for(size_t i = 0; i < args.len; i++) {
-		w_value_t v = w_evalt(ctx, this, &args.ptr[i]);
-		if(v.type != W_VALUE_STRING) {
-			w_value_t vs = w_value_tostring(&v);
-			w_value_release(&v);
-			v = vs;
-		}
+	str->hash = 0;
+	for(size_t i = 0; i < argc; i++) {
+		w_value_t v;
+		GET_STRING(v, i);
 		w_string_t *s = v.string;
 		str->ptr = realloc(str->ptr, str->len+s->len);
 		memcpy(str->ptr+str->len, s->ptr, s->len);
@@ -1124,21 +1052,19 @@ W_COMMAND(w_cmd_string_cat_mut) {
 
 UNMUT(w_cmd_string_cat, w_cmd_string_cat_mut, string->refcount);
 
-W_COMMAND(w_cmd_string_split) {
-	ARGS_EQUAL("string:split", 1);
-	w_value_t vby = w_evalt(ctx, this, &args.ptr[0]);
-	if(vby.type != W_VALUE_STRING) {
-		w_status_err(ctx->status, w_error_new(pos, "Expected string, got %s.", w_typename(vby.type)));
+W_STRICT(w_cmd_string_split) {
+	ARGV_EQUAL("string:split", 1);
+	if(argv[0].type != W_VALUE_STRING) {
+		w_status_err(ctx->status, w_error_new(pos, "Expected string, got %s.", w_typename(argv[0].type)));
 		return (w_value_t){};
 	}
-	w_string_t *by = vby.string;
+	w_string_t *by = argv[0].string;
 	w_string_t *s = obj->string;
 	w_list_t *ret = malloc(sizeof(w_list_t));
 	*ret = (w_list_t){1, 0, NULL};
 	if(by->len > s->len) {
 		ret->ptr = malloc(sizeof(w_value_t));
 		ret->ptr[0] = w_value_clone(obj);
-		w_value_release(&vby);
 		return (w_value_t){.type = W_VALUE_LIST, .list = ret};
 	}
 	size_t start = 0;
@@ -1160,12 +1086,11 @@ W_COMMAND(w_cmd_string_split) {
 		}
 	}
 	ADD(s->len);
-	w_value_release(&vby);
 	return (w_value_t){.type = W_VALUE_LIST, .list = ret};
 }
 
-W_COMMAND(w_cmd_clone) {
-	ARGS_NONE("clone");
+W_STRICT(w_cmd_clone) {
+	ARGV_NONE("clone");
 	return w_value_clone(obj);
 }
 
@@ -1181,7 +1106,236 @@ W_COMMAND(w_cmd_cmd) {
 		}
 		argv[i] = (w_cmd_arg_t){w_astrdup(&args.ptr[i].string)};
 	}
+	// the resolver puts the arguments in the first slots of the body's frame
+	w_ast_t *body = &args.ptr[args.len-1];
+	// (and does so for a body that hasn't been parsed yet once it is)
+	bool lazy = body->type == W_AST_COMMANDS && body->commands.source != NULL;
+	bool slots = lazy || (body->type == W_AST_COMMANDS && body->commands.layout != NULL);
+	for(size_t i = 0; i < argc && slots && !lazy; i++)
+		slots = args.ptr[i].slot.layout == body->commands.layout && args.ptr[i].slot.index == i;
+	// a body resolved on its own doesn't refer to any of the blocks around it, so the command can share it with the rest of the tree
+	// instead of copying it. anything else gets a copy in a tree of its own.
+	w_tree_t *tree;
+	if(lazy || (body->type == W_AST_COMMANDS && body->commands.layout != NULL && body->commands.layout->parent == NULL)) {
+		tree = body->commands.tree;
+		if(tree != NULL)
+			tree->refcount++;
+	} else {
+		tree = w_tree_new(w_ast_dup(body));
+		body = &tree->ast;
+	}
 	w_cmd_t *cmd = malloc(sizeof(w_cmd_t));
-	*cmd = (w_cmd_t){1, argc, argv, w_ast_dup(&args.ptr[args.len-1]), NULL};
+	*cmd = (w_cmd_t){1, argc, argv, body, tree, NULL, slots};
 	return (w_value_t){.type = W_VALUE_COMMAND, .cmd = cmd};
 }
+
+// memoization
+
+/// A cached result of a memoized command
+typedef struct memo_entry {
+	uint64_t hash; // hash of the arguments
+	size_t argc;
+	w_value_t *argv; // copies of the arguments, which nothing else can change
+	w_value_t ret;
+	struct memo_entry *next; // next entry in the same bucket
+	struct memo_entry *newer, *older; // neighbours in the order entries were last used in
+} memo_entry_t;
+
+/// State of a command made by memo. The command's obj is cmd, which is why it comes first.
+typedef struct memo {
+	w_value_t cmd; // command being memoized
+	w_refcount_t refcount; // held by the command and by each call that's running, since a call can drop the command
+	size_t len, cap; // number of entries and buckets
+	size_t limit; // most entries kept, 0 for no limit
+	memo_entry_t **buckets;
+	memo_entry_t *newest, *oldest;
+} memo_t;
+
+// copies a value along with everything in it, so that changing the original in place doesn't change the copy
+static w_value_t freeze(w_value_t *v) {
+	switch(v->type) {
+		case W_VALUE_STRING:
+			return w_value_clone(v);
+		case W_VALUE_LIST: {
+			w_list_t *l = malloc(sizeof(w_list_t));
+			*l = (w_list_t){1, v->list->len, malloc(sizeof(w_value_t)*v->list->len)};
+			for(size_t i = 0; i < l->len; i++)
+				l->ptr[i] = freeze(&v->list->ptr[i]);
+			return (w_value_t){.type = W_VALUE_LIST, .list = l};
+		}
+		case W_VALUE_MAP: {
+			w_value_t copy = w_value_clone(v);
+			w_map_iter_t it = {};
+			w_astring_t *key;
+			w_value_t *item;
+			while(w_map_next(copy.map, &it, &key, &item)) {
+				w_value_t old = *item;
+				*item = freeze(&old);
+				w_value_release(&old);
+			}
+			return copy;
+		}
+		default:
+			w_value_ref(v);
+			return *v;
+	}
+}
+
+static void memo_unlink(memo_t *m, memo_entry_t *e) {
+	if(e->newer != NULL)
+		e->newer->older = e->older;
+	else
+		m->newest = e->older;
+	if(e->older != NULL)
+		e->older->newer = e->newer;
+	else
+		m->oldest = e->newer;
+}
+
+static void memo_push(memo_t *m, memo_entry_t *e) {
+	e->newer = NULL;
+	e->older = m->newest;
+	if(m->newest != NULL)
+		m->newest->newer = e;
+	else
+		m->oldest = e;
+	m->newest = e;
+}
+
+static void memo_entry_free(memo_entry_t *e) {
+	for(size_t i = 0; i < e->argc; i++)
+		w_value_release(&e->argv[i]);
+	free(e->argv);
+	w_value_release(&e->ret);
+	free(e);
+}
+
+// removes an entry from its bucket and the order of use, and frees it
+static void memo_evict(memo_t *m, memo_entry_t *e) {
+	memo_entry_t **p = &m->buckets[e->hash%m->cap];
+	while(*p != e)
+		p = &(*p)->next;
+	*p = e->next;
+	memo_unlink(m, e);
+	memo_entry_free(e);
+	m->len--;
+}
+
+static void memo_clear(memo_t *m) {
+	while(m->oldest != NULL)
+		memo_evict(m, m->oldest);
+}
+
+static void memo_release(memo_t *m) {
+	if(--m->refcount != 0)
+		return;
+	memo_clear(m);
+	w_value_release(&m->cmd);
+	free(m->buckets);
+	free(m);
+}
+
+static void memo_drop(w_value_t *obj) {
+	memo_release((memo_t *)obj);
+}
+
+static void memo_insert(memo_t *m, memo_entry_t *e) {
+	if(m->len >= m->cap) {
+		// buckets are doubled once there's an entry for each, so that they stay short
+		size_t cap = m->cap*2;
+		memo_entry_t **buckets = calloc(cap, sizeof(memo_entry_t *));
+		for(size_t i = 0; i < m->cap; i++) {
+			memo_entry_t *curr = m->buckets[i];
+			while(curr != NULL) {
+				memo_entry_t *next = curr->next;
+				curr->next = buckets[curr->hash%cap];
+				buckets[curr->hash%cap] = curr;
+				curr = next;
+			}
+		}
+		free(m->buckets);
+		m->buckets = buckets;
+		m->cap = cap;
+	}
+	e->next = m->buckets[e->hash%m->cap];
+	m->buckets[e->hash%m->cap] = e;
+	memo_push(m, e);
+	m->len++;
+	if(m->limit != 0 && m->len > m->limit)
+		memo_evict(m, m->oldest);
+}
+
+W_STRICT(w_cmd_memo_call) {
+	memo_t *m = (memo_t *)obj;
+	uint64_t hash = argc;
+	for(size_t i = 0; i < argc; i++)
+		hash = hash*31+w_value_hash(&argv[i]);
+	for(memo_entry_t *e = m->buckets[hash%m->cap]; e != NULL; e = e->next) {
+		if(e->hash != hash || e->argc != argc)
+			continue;
+		size_t i = 0;
+		while(i < argc && w_value_same(&e->argv[i], &argv[i]))
+			i++;
+		if(i < argc)
+			continue;
+		memo_unlink(m, e);
+		memo_push(m, e);
+		// results are copied both ways too, so that changing one in place doesn't change the cached one
+		return freeze(&e->ret);
+	}
+	// the arguments are copied before the call, since it could change them
+	memo_entry_t *e = malloc(sizeof(memo_entry_t));
+	*e = (memo_entry_t){hash, argc, malloc(sizeof(w_value_t)*(argc > 0 ? argc : 1))};
+	w_value_t args[argc > 0 ? argc : 1];
+	for(size_t i = 0; i < argc; i++) {
+		e->argv[i] = freeze(&argv[i]);
+		args[i] = take(&argv[i]);
+	}
+	m->refcount++;
+	w_value_t ret = w_cmd_call(ctx, m->cmd.cmd, argc, args, NULL);
+	if(ctx->status->tag != W_STATUS_OK) {
+		e->ret = (w_value_t){.type = W_VALUE_NULL};
+		memo_entry_free(e);
+		memo_release(m);
+		return (w_value_t){};
+	}
+	e->ret = freeze(&ret);
+	memo_insert(m, e);
+	memo_release(m);
+	return ret;
+}
+
+W_STRICT(w_cmd_memo) {
+	ARGV_BETWEEN("memo", 1, 2);
+	if(argv[0].type != W_VALUE_COMMAND) {
+		w_status_err(ctx->status, w_error_new(ARG_POS(0), "Expected command, got %s.", w_typename(argv[0].type)));
+		return (w_value_t){};
+	}
+	int64_t limit = 0;
+	if(argc == 2) {
+		if(argv[1].type != W_VALUE_INT) {
+			w_status_err(ctx->status, w_error_new(ARG_POS(1), "Expected int, got %s.", w_typename(argv[1].type)));
+			return (w_value_t){};
+		}
+		limit = argv[1].int_;
+		if(limit < 1) {
+			w_status_err(ctx->status, w_error_new(ARG_POS(1), "memo keeps at least 1 result, got %" PRId64 ".", limit));
+			return (w_value_t){};
+		}
+	}
+	memo_t *m = malloc(sizeof(memo_t));
+	*m = (memo_t){take(&argv[0]), 1, 0, 16, limit, calloc(16, sizeof(memo_entry_t *)), NULL, NULL};
+	w_ecmd_t *ecmd = malloc(sizeof(w_ecmd_t));
+	*ecmd = (w_ecmd_t){1, NULL, &m->cmd, &w_cmd_memo_call, false, &memo_drop};
+	return (w_value_t){.type = W_VALUE_EXTERNCMD, .externcmd = ecmd};
+}
+
+W_STRICT(w_cmd_memo_clear) {
+	ARGV_EQUAL("memo-clear", 1);
+	if(argv[0].type != W_VALUE_EXTERNCMD || argv[0].externcmd->strict != &w_cmd_memo_call) {
+		w_status_err(ctx->status, w_error_new(ARG_POS(0), "Expected a command made by memo, got %s.", w_typename(argv[0].type)));
+		return (w_value_t){};
+	}
+	memo_clear((memo_t *)argv[0].externcmd->obj);
+	return (w_value_t){.type = W_VALUE_NULL};
+}
@@ -1,4 +1,5 @@
-/// Contains all the standard commands
+/// Contains all the standard commands. Commands that only need the values of their arguments are strict (W_STRICT), and the ones that
+/// decide whether and how to evaluate their arguments are lazy (W_COMMAND).
 
 #ifndef W_COMMAND_H
 #define W_COMMAND_H
@@ -8,18 +9,18 @@
 W_COMMAND(w_cmd_echo); // echoes all given values
 W_COMMAND(w_cmd_echoln); // same as above, but echoes a newline (U+000A) after
 
-W_COMMAND(w_cmd_read); // reads stdin or a file
+W_STRICT(w_cmd_read); // reads stdin or a file
 W_COMMAND(w_cmd_readln); // echoes a prompt, and reads a single line
 
-W_COMMAND(w_cmd_write); // writes to a file
+W_STRICT(w_cmd_write); // writes to a file
 
 // arithmetic operations
 
-W_COMMAND(w_cmd_add);
-W_COMMAND(w_cmd_sub);
-W_COMMAND(w_cmd_mul);
-W_COMMAND(w_cmd_div);
-W_COMMAND(w_cmd_mod);
+W_STRICT(w_cmd_add);
+W_STRICT(w_cmd_sub);
+W_STRICT(w_cmd_mul);
+W_STRICT(w_cmd_div);
+W_STRICT(w_cmd_mod);
 
 // state operations
 
@@ -30,20 +31,20 @@ W_COMMAND(w_cmd_del);
 
 // boolean operations
 
-W_COMMAND(w_cmd_equ);
-W_COMMAND(w_cmd_neq);
-W_COMMAND(w_cmd_lt);
-W_COMMAND(w_cmd_lte);
-W_COMMAND(w_cmd_gt);
-W_COMMAND(w_cmd_gte);
+W_STRICT(w_cmd_equ);
+W_STRICT(w_cmd_neq);
+W_STRICT(w_cmd_lt);
+W_STRICT(w_cmd_lte);
+W_STRICT(w_cmd_gt);
+W_STRICT(w_cmd_gte);
 W_COMMAND(w_cmd_or);
 W_COMMAND(w_cmd_and);
 
 // type conversions
 
-W_COMMAND(w_cmd_int);
-W_COMMAND(w_cmd_float);
-W_COMMAND(w_cmd_string);
+W_STRICT(w_cmd_int);
+W_STRICT(w_cmd_float);
+W_STRICT(w_cmd_string);
 
 // control constructs
 
@@ -54,62 +55,66 @@ W_COMMAND(w_cmd_return);
 W_COMMAND(w_cmd_while);
 W_COMMAND(w_cmd_do); // does a block
 W_COMMAND(w_cmd_for);
+w_value_t w_for(w_ctx_t *ctx, w_value_t *this, w_value_t coll, w_args_t args); // runs a for loop over an already evaluated collection, which is consumed
 
 // data types
 
-W_COMMAND(w_cmd_list);
-W_COMMAND(w_cmd_range); // takes 2 arguments: $start, $end. returns a range containing [$start, $end)
-W_COMMAND(w_cmd_map);
+W_STRICT(w_cmd_list);
+W_STRICT(w_cmd_range); // takes 2 arguments: $start, $end. returns a range containing [$start, $end)
+W_STRICT(w_cmd_map);
 
-W_COMMAND(w_cmd_refcount); // gets the refcount of a value. returns -1 if the given value does not have a refcount
+W_STRICT(w_cmd_refcount); // gets the refcount of a value. returns -1 if the given value does not have a refcount
 
 // list operations
 
-W_COMMAND(w_cmd_list_set_mut); // sets a value in an list
-W_COMMAND(w_cmd_list_set);
-W_COMMAND(w_cmd_list_push_mut); // pushes values to the end of lists
-W_COMMAND(w_cmd_list_push);
-W_COMMAND(w_cmd_list_unshift_mut); // pushes values to the start of lists 
-W_COMMAND(w_cmd_list_unshift);
-W_COMMAND(w_cmd_list_pop_mut); // pops a value from the end of a list
-W_COMMAND(w_cmd_list_pop);
-W_COMMAND(w_cmd_list_shift_mut); // pops a value from the start of a list
-W_COMMAND(w_cmd_list_shift);
-W_COMMAND(w_cmd_list_slice_mut); // slices a list
-W_COMMAND(w_cmd_list_slice);
-W_COMMAND(w_cmd_list_cat_mut); // concats lists
-W_COMMAND(w_cmd_list_cat);
-W_COMMAND(w_cmd_list_fill_mut); // fills a list
-W_COMMAND(w_cmd_list_fill);
-W_COMMAND(w_cmd_list_dup_mut); // duplicates a list
-W_COMMAND(w_cmd_list_dup);
-W_COMMAND(w_cmd_list_reverse_mut); // reverses a list
-W_COMMAND(w_cmd_list_reverse);
-
-W_COMMAND(w_cmd_new_list); // makes a list with N entries
+W_STRICT(w_cmd_list_set_mut); // sets a value in an list
+W_STRICT(w_cmd_list_set);
+W_STRICT(w_cmd_list_push_mut); // pushes values to the end of lists
+W_STRICT(w_cmd_list_push);
+W_STRICT(w_cmd_list_unshift_mut); // pushes values to the start of lists 
+W_STRICT(w_cmd_list_unshift);
+W_STRICT(w_cmd_list_pop_mut); // pops a value from the end of a list
+W_STRICT(w_cmd_list_pop);
+W_STRICT(w_cmd_list_shift_mut); // pops a value from the start of a list
+W_STRICT(w_cmd_list_shift);
+W_STRICT(w_cmd_list_slice_mut); // slices a list
+W_STRICT(w_cmd_list_slice);
+W_STRICT(w_cmd_list_cat_mut); // concats lists
+W_STRICT(w_cmd_list_cat);
+W_STRICT(w_cmd_list_fill_mut); // fills a list
+W_STRICT(w_cmd_list_fill);
+W_STRICT(w_cmd_list_dup_mut); // duplicates a list
+W_STRICT(w_cmd_list_dup);
+W_STRICT(w_cmd_list_reverse_mut); // reverses a list
+W_STRICT(w_cmd_list_reverse);
+
+W_STRICT(w_cmd_new_list); // makes a list with N entries
 
 // map operations
 
-W_COMMAND(w_cmd_map_set_mut); // sets a value in a map
-W_COMMAND(w_cmd_map_set);
-W_COMMAND(w_cmd_map_del_mut);
-W_COMMAND(w_cmd_map_del);
+W_STRICT(w_cmd_map_set_mut); // sets a value in a map
+W_STRICT(w_cmd_map_set);
+W_STRICT(w_cmd_map_del_mut);
+W_STRICT(w_cmd_map_del);
 
 // string operations
-W_COMMAND(w_cmd_string_set_mut);
-W_COMMAND(w_cmd_string_set);
-W_COMMAND(w_cmd_string_slice_mut);
-W_COMMAND(w_cmd_string_slice);
-W_COMMAND(w_cmd_string_dup_mut);
-W_COMMAND(w_cmd_string_dup);
-W_COMMAND(w_cmd_string_reverse_mut);
-W_COMMAND(w_cmd_string_reverse);
-W_COMMAND(w_cmd_string_cat_mut);
-W_COMMAND(w_cmd_string_cat);
-W_COMMAND(w_cmd_string_split);
-
-W_COMMAND(w_cmd_clone); // clones a list or a map
+W_STRICT(w_cmd_string_set_mut);
+W_STRICT(w_cmd_string_set);
+W_STRICT(w_cmd_string_slice_mut);
+W_STRICT(w_cmd_string_slice);
+W_STRICT(w_cmd_string_dup_mut);
+W_STRICT(w_cmd_string_dup);
+W_STRICT(w_cmd_string_reverse_mut);
+W_STRICT(w_cmd_string_reverse);
+W_STRICT(w_cmd_string_cat_mut);
+W_STRICT(w_cmd_string_cat);
+W_STRICT(w_cmd_string_split);
+
+W_STRICT(w_cmd_clone); // clones a list or a map
 
 W_COMMAND(w_cmd_cmd); // creates a command
+W_STRICT(w_cmd_memo); // wraps a command in one that caches its results by argument, optionally keeping only the N last used ones
+W_STRICT(w_cmd_memo_call); // calls a command made by memo
+W_STRICT(w_cmd_memo_clear); // empties the cache of a command made by memo
 
 #endif
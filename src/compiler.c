@@ -0,0 +1,440 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "compiler.h"
+#include "commands.h"
+#include "jit.h"
+
+/// Compiler state
+typedef struct compiler {
+	w_chunk_t *chunk;
+	size_t cap; // capacity of chunk->code
+	size_t stack, scopes; // current stack size and scope depth
+	size_t calls; // number of commands whose arguments are being evaluated
+} compiler_t;
+
+static size_t emit(compiler_t *c, w_insn_t insn) {
+	w_chunk_t *chunk = c->chunk;
+	if(chunk->len >= c->cap) {
+		c->cap = c->cap == 0 ? 16 : c->cap*2;
+		chunk->code = realloc(chunk->code, sizeof(w_insn_t)*c->cap);
+	}
+	chunk->code[chunk->len] = insn;
+	return chunk->len++;
+}
+
+// adjusts the tracked stack size, recording the maximum
+static void grow(compiler_t *c, int amt) {
+	c->stack += amt;
+	if(c->stack > c->chunk->max_stack)
+		c->chunk->max_stack = c->stack;
+}
+
+static void compile_commands(compiler_t *c, w_ast_commands_t *cmds, bool tail);
+
+// tail is set for expressions whose value is the result of the whole chunk
+static void compile_expr(compiler_t *c, w_ast_t *ast, bool tail) {
+	switch(ast->type) {
+		case W_AST_NULL:
+			emit(c, (w_insn_t){.op = W_OP_NULL});
+			grow(c, 1);
+			break;
+		case W_AST_INT:
+			emit(c, (w_insn_t){.op = W_OP_INT, .int_ = ast->int_});
+			grow(c, 1);
+			break;
+		case W_AST_FLOAT:
+			emit(c, (w_insn_t){.op = W_OP_FLOAT, .float_ = ast->float_});
+			grow(c, 1);
+			break;
+		case W_AST_STRING:
+			emit(c, (w_insn_t){.op = W_OP_STRING, .ast = ast});
+			grow(c, 1);
+			break;
+		case W_AST_CONST:
+			emit(c, (w_insn_t){.op = W_OP_CONST, .ast = ast});
+			grow(c, 1);
+			break;
+		case W_AST_VAR:
+			if(w_astreqc(&ast->string, "this"))
+				emit(c, (w_insn_t){.op = W_OP_THIS});
+			else
+				emit(c, (w_insn_t){.op = W_OP_VAR, .ast = ast});
+			grow(c, 1);
+			break;
+		case W_AST_INDEX:
+			// the common $var:member and $list:$i don't need to reference anything
+			if(w_ast_inert(ast->index.left) && w_ast_inert(ast->index.right)) {
+				emit(c, (w_insn_t){.op = W_OP_INDEX_BORROW, .ast = ast});
+				grow(c, 1);
+				break;
+			}
+			compile_expr(c, ast->index.left, false);
+			compile_expr(c, ast->index.right, false);
+			emit(c, (w_insn_t){.op = W_OP_INDEX, .ast = ast});
+			grow(c, -1);
+			break;
+		case W_AST_COMMANDS:
+			// a body that hasn't been parsed is only ever the argument of the cmd builtin, which isn't internal
+			if(ast->commands.source != NULL) {
+				emit(c, (w_insn_t){.op = W_OP_NULL});
+				grow(c, 1);
+				break;
+			}
+			// nested blocks are compiled inline with their own scope
+			emit(c, (w_insn_t){.op = W_OP_ENTER, .ast = ast});
+			if(++c->scopes > c->chunk->max_scopes)
+				c->chunk->max_scopes = c->scopes;
+			compile_commands(c, &ast->commands, tail);
+			emit(c, (w_insn_t){.op = W_OP_LEAVE});
+			c->scopes--;
+			break;
+	}
+}
+
+// compiles a call to whatever cmd's name refers to
+static void compile_call(compiler_t *c, w_ast_command_t *cmd, bool tail) {
+	w_ast_t *name = &cmd->ptr[0];
+	size_t lookup = 0;
+	bool named = name->type == W_AST_STRING;
+	bool method = name->type == W_AST_INDEX && name->index.right->type == W_AST_STRING;
+	if(named) {
+		lookup = emit(c, (w_insn_t){.op = W_OP_LOOKUP, .cmd = cmd});
+		grow(c, 1);
+	}
+	else if(method)
+		compile_expr(c, name->index.left, false);
+	else
+		compile_expr(c, name, false);
+	size_t call = emit(c, (w_insn_t){.op = method ? W_OP_METHOD : W_OP_CALL, .cmd = cmd});
+	c->calls++;
+	// argument code, only ran for internal and strict commands
+	size_t argc = cmd->len-1;
+	size_t *checks = malloc(sizeof(size_t)*argc);
+	for(size_t i = 0; i < argc; i++) {
+		checks[i] = emit(c, (w_insn_t){.op = W_OP_ARG, .int_ = i});
+		compile_expr(c, &cmd->ptr[i+1], false);
+	}
+	size_t invoke = emit(c, (w_insn_t){.op = tail ? W_OP_TAIL : W_OP_INVOKE, .cmd = cmd});
+	c->calls--;
+	for(size_t i = 0; i < argc; i++)
+		c->chunk->code[checks[i]].arg = invoke;
+	free(checks);
+	c->chunk->code[call].arg = invoke+1;
+	if(named)
+		c->chunk->code[lookup].arg = invoke+1;
+	// arguments and the command are replaced by the result
+	grow(c, -(int)argc);
+}
+
+/// Core builtins with dedicated instructions
+typedef enum core_kind {
+	CORE_OP, // arithmetic, folded left to right
+	CORE_CMP, // comparisons between exactly 2 values
+	CORE_IF,
+	CORE_WHILE,
+	CORE_FOR,
+	CORE_RETURN
+} core_kind_t;
+
+static struct {
+	char *name;
+	w_externcmd_t builtin;
+	w_strictcmd_t strict;
+	core_kind_t kind;
+	w_opcode_t op;
+} cores[] = {
+	{"+", NULL, &w_cmd_add, CORE_OP, W_OP_ADD},
+	{"-", NULL, &w_cmd_sub, CORE_OP, W_OP_SUB},
+	{"*", NULL, &w_cmd_mul, CORE_OP, W_OP_MUL},
+	{"/", NULL, &w_cmd_div, CORE_OP, W_OP_DIV},
+	{"%", NULL, &w_cmd_mod, CORE_OP, W_OP_MOD},
+	{"=", NULL, &w_cmd_equ, CORE_CMP, W_OP_EQU},
+	{"!=", NULL, &w_cmd_neq, CORE_CMP, W_OP_NEQ},
+	{"<", NULL, &w_cmd_lt, CORE_CMP, W_OP_LT},
+	{"<=", NULL, &w_cmd_lte, CORE_CMP, W_OP_LTE},
+	{">", NULL, &w_cmd_gt, CORE_CMP, W_OP_GT},
+	{">=", NULL, &w_cmd_gte, CORE_CMP, W_OP_GTE},
+	{"if", &w_cmd_if, NULL, CORE_IF},
+	{"while", &w_cmd_while, NULL, CORE_WHILE},
+	{"for", &w_cmd_for, NULL, CORE_FOR},
+	{"return", &w_cmd_return, NULL, CORE_RETURN}
+};
+
+// finds the core builtin cmd calls, if its arguments have a shape that can be compiled inline. returns -1 otherwise.
+static int find_core(w_ast_command_t *cmd) {
+	w_ast_t *name = &cmd->ptr[0];
+	if(name->type != W_AST_STRING)
+		return -1;
+	size_t argc = cmd->len-1;
+	for(size_t i = 0; i < sizeof(cores)/sizeof(cores[0]); i++) {
+		if(!w_astreqc(&name->string, cores[i].name))
+			continue;
+		switch(cores[i].kind) {
+			case CORE_OP:
+				return argc >= 1 ? i : -1;
+			case CORE_CMP:
+			case CORE_WHILE:
+				return argc == 2 ? i : -1;
+			case CORE_IF:
+				return argc >= 2 ? i : -1;
+			case CORE_RETURN:
+				return argc <= 1 ? i : -1;
+			case CORE_FOR: {
+				// anything else either errors, or evaluates the body outside of the loop's scope
+				if(argc < 2 || argc > 4)
+					return -1;
+				for(size_t j = 1; j < argc-1; j++)
+					if(cmd->ptr[j].type != W_AST_VAR)
+						return -1;
+				w_ast_t *body = &cmd->ptr[argc];
+				return body->type == W_AST_COMMANDS && body->commands.len > 0 ? i : -1;
+			}
+		}
+	}
+	return -1;
+}
+
+static void add_handler(compiler_t *c, w_handler_t h) {
+	w_chunk_t *chunk = c->chunk;
+	chunk->handlers = realloc(chunk->handlers, sizeof(w_handler_t)*(chunk->handlers_len+1));
+	chunk->handlers[chunk->handlers_len++] = h;
+}
+
+// compiles the inline version of a core builtin. leaves a single value on the stack, like a call would.
+static void compile_core(compiler_t *c, w_ast_command_t *cmd, int core, bool tail) {
+	w_ast_t *args = cmd->ptr+1;
+	size_t argc = cmd->len-1;
+	size_t base = c->stack;
+	w_insn_t *code;
+	switch(cores[core].kind) {
+		case CORE_OP:
+			compile_expr(c, &args[0], false);
+			for(size_t i = 1; i < argc; i++) {
+				compile_expr(c, &args[i], false);
+				emit(c, (w_insn_t){.op = cores[core].op, .ast = &cmd->ptr[0]});
+				grow(c, -1);
+			}
+			break;
+		case CORE_CMP:
+			compile_expr(c, &args[0], false);
+			compile_expr(c, &args[1], false);
+			emit(c, (w_insn_t){.op = cores[core].op});
+			grow(c, -1);
+			break;
+		case CORE_IF: {
+			size_t conds = argc/2;
+			size_t *ends = malloc(sizeof(size_t)*conds);
+			for(size_t i = 0; i < conds; i++) {
+				compile_expr(c, &args[i*2], false);
+				size_t skip = emit(c, (w_insn_t){.op = W_OP_JUMP_IF_NOT});
+				grow(c, -1);
+				compile_expr(c, &args[i*2+1], tail);
+				ends[i] = emit(c, (w_insn_t){.op = W_OP_JUMP});
+				c->chunk->code[skip].arg = c->chunk->len;
+				c->stack = base;
+			}
+			if(conds*2 != argc)
+				compile_expr(c, &args[argc-1], tail);
+			else {
+				emit(c, (w_insn_t){.op = W_OP_NULL});
+				grow(c, 1);
+			}
+			for(size_t i = 0; i < conds; i++)
+				c->chunk->code[ends[i]].arg = c->chunk->len;
+			free(ends);
+			break;
+		}
+		case CORE_WHILE: {
+			// the last result stays on the stack while the condition is evaluated
+			emit(c, (w_insn_t){.op = W_OP_NULL});
+			grow(c, 1);
+			size_t top = c->chunk->len;
+			compile_expr(c, &args[0], false);
+			size_t exit = emit(c, (w_insn_t){.op = W_OP_JUMP_IF_NOT});
+			grow(c, -1);
+			emit(c, (w_insn_t){.op = W_OP_POP});
+			grow(c, -1);
+			size_t start = c->chunk->len;
+			compile_expr(c, &args[1], false);
+			size_t end = c->chunk->len;
+			emit(c, (w_insn_t){.op = W_OP_LOOP, .arg = top, .cmd = cmd});
+			c->chunk->code[exit].arg = c->chunk->len;
+			add_handler(c, (w_handler_t){start, end, base, c->calls, c->scopes-1, c->chunk->len, top});
+			break;
+		}
+		case CORE_RETURN:
+			// the returned value is the result of the whole command, so it's always in tail position
+			if(argc == 1)
+				compile_expr(c, &args[0], true);
+			else {
+				emit(c, (w_insn_t){.op = W_OP_NULL});
+				grow(c, 1);
+			}
+			emit(c, (w_insn_t){.op = W_OP_RETURN});
+			break;
+		case CORE_FOR: {
+			// the list, the index and the last result are kept on the stack
+			w_ast_t *body = &args[argc-1];
+			compile_expr(c, &args[argc-2], false);
+			size_t init = emit(c, (w_insn_t){.op = W_OP_FOR_INIT, .cmd = cmd});
+			grow(c, 2);
+			size_t top = emit(c, (w_insn_t){.op = W_OP_FOR_NEXT, .cmd = cmd});
+			grow(c, -1);
+			// the body runs directly in the iteration's scope
+			if(++c->scopes > c->chunk->max_scopes)
+				c->chunk->max_scopes = c->scopes;
+			size_t start = c->chunk->len;
+			compile_commands(c, &body->commands, false);
+			size_t end = c->chunk->len;
+			emit(c, (w_insn_t){.op = W_OP_LEAVE});
+			c->scopes--;
+			emit(c, (w_insn_t){.op = W_OP_LOOP, .arg = top, .cmd = cmd});
+			size_t done = emit(c, (w_insn_t){.op = W_OP_FOR_END});
+			grow(c, -2);
+			code = c->chunk->code;
+			code[top].arg = done;
+			code[init].arg = c->chunk->len;
+			add_handler(c, (w_handler_t){start, end, base+2, c->calls, c->scopes-1, done, top});
+			break;
+		}
+	}
+}
+
+static void compile_command(compiler_t *c, w_ast_command_t *cmd, bool tail) {
+	int core = find_core(cmd);
+	if(core < 0) {
+		compile_call(c, cmd, tail);
+		return;
+	}
+	// guarded, since the name can be rebound at any point
+	size_t guard = emit(c, (w_insn_t){.op = W_OP_GUARD, .cmd = cmd, .builtin = cores[core].builtin, .strict = cores[core].strict});
+	size_t base = c->stack;
+	compile_core(c, cmd, core, tail);
+	size_t skip = emit(c, (w_insn_t){.op = W_OP_JUMP});
+	c->chunk->code[guard].arg = c->chunk->len;
+	c->stack = base;
+	compile_call(c, cmd, tail);
+	c->chunk->code[skip].arg = c->chunk->len;
+}
+
+static void compile_commands(compiler_t *c, w_ast_commands_t *cmds, bool tail) {
+	for(size_t i = 0; i < cmds->len; i++) {
+		if(i != 0) {
+			emit(c, (w_insn_t){.op = W_OP_POP});
+			grow(c, -1);
+		}
+		compile_command(c, &cmds->ptr[i], tail && i == cmds->len-1);
+	}
+}
+
+w_chunk_t *w_compile(w_ast_t *ast) {
+	w_chunk_t *chunk = malloc(sizeof(w_chunk_t));
+	*chunk = (w_chunk_t){0, NULL, 0, 1, 0, NULL, 0, NULL, NULL};
+	compiler_t c = (compiler_t){chunk, 0, 0, 1, 0};
+	compile_commands(&c, &ast->commands, true);
+	emit(&c, (w_insn_t){.op = W_OP_END});
+	chunk->code = realloc(chunk->code, sizeof(w_insn_t)*chunk->len);
+	// code generated ahead of time was made from the same instructions, so it can run them
+	w_native_t *native = ast->commands.native;
+	if(native != NULL && native->len == chunk->len)
+		chunk->native = native;
+	return chunk;
+}
+
+void w_chunk_free(w_chunk_t *chunk) {
+	if(chunk->jit != NULL)
+		w_jit_free(chunk->jit);
+	free(chunk->code);
+	free(chunk->handlers);
+	free(chunk);
+}
+
+void w_chunk_print(w_chunk_t *chunk) {
+	static char *names[] = {
+		[W_OP_NULL] = "null",
+		[W_OP_INT] = "int",
+		[W_OP_FLOAT] = "float",
+		[W_OP_STRING] = "string",
+		[W_OP_CONST] = "const",
+		[W_OP_VAR] = "var",
+		[W_OP_THIS] = "this",
+		[W_OP_INDEX] = "index",
+		[W_OP_INDEX_BORROW] = "index_borrow",
+		[W_OP_ENTER] = "enter",
+		[W_OP_LEAVE] = "leave",
+		[W_OP_LOOKUP] = "lookup",
+		[W_OP_CALL] = "call",
+		[W_OP_METHOD] = "method",
+		[W_OP_ARG] = "arg",
+		[W_OP_INVOKE] = "invoke",
+		[W_OP_TAIL] = "tail",
+		[W_OP_POP] = "pop",
+		[W_OP_GUARD] = "guard",
+		[W_OP_ADD] = "add",
+		[W_OP_SUB] = "sub",
+		[W_OP_MUL] = "mul",
+		[W_OP_DIV] = "div",
+		[W_OP_MOD] = "mod",
+		[W_OP_EQU] = "equ",
+		[W_OP_NEQ] = "neq",
+		[W_OP_LT] = "lt",
+		[W_OP_LTE] = "lte",
+		[W_OP_GT] = "gt",
+		[W_OP_GTE] = "gte",
+		[W_OP_JUMP] = "jump",
+		[W_OP_JUMP_IF_NOT] = "jump_if_not",
+		[W_OP_LOOP] = "loop",
+		[W_OP_FOR_INIT] = "for_init",
+		[W_OP_FOR_NEXT] = "for_next",
+		[W_OP_FOR_END] = "for_end",
+		[W_OP_RETURN] = "return",
+		[W_OP_TAIL] = "tail",
+		[W_OP_END] = "end"
+	};
+	for(size_t i = 0; i < chunk->len; i++) {
+		w_insn_t *insn = &chunk->code[i];
+		printf("%4zu %s", i, names[insn->op]);
+		switch(insn->op) {
+			case W_OP_INT:
+				printf(" %" PRId64, insn->int_);
+				break;
+			case W_OP_FLOAT:
+				printf(" %f", insn->float_);
+				break;
+			case W_OP_STRING:
+			case W_OP_CONST:
+			case W_OP_VAR:
+			case W_OP_INDEX_BORROW:
+				printf(" ");
+				w_ast_print(insn->ast);
+				break;
+			case W_OP_LOOKUP:
+			case W_OP_GUARD:
+				printf(" ");
+				w_ast_print(&insn->cmd->ptr[0]);
+				printf(" -> %zu", insn->arg);
+				break;
+			case W_OP_CALL:
+				printf(" (%zu args) -> %zu", insn->cmd->len-1, insn->arg);
+				break;
+			case W_OP_METHOD:
+				printf(" ");
+				w_ast_print(insn->cmd->ptr[0].index.right);
+				printf(" (%zu args) -> %zu", insn->cmd->len-1, insn->arg);
+				break;
+			case W_OP_ARG:
+				printf(" %" PRId64 " -> %zu", insn->int_, insn->arg);
+				break;
+			case W_OP_JUMP:
+			case W_OP_JUMP_IF_NOT:
+			case W_OP_LOOP:
+			case W_OP_FOR_INIT:
+			case W_OP_FOR_NEXT:
+				printf(" -> %zu", insn->arg);
+				break;
+		}
+		printf("\n");
+	}
+}
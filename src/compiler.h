@@ -0,0 +1,100 @@
+/// Describes the bytecode compiler
+
+#ifndef W_COMPILER_H
+#define W_COMPILER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "interpreter.h"
+
+/// Instruction opcodes
+typedef enum w_opcode {
+	// literals
+	W_OP_NULL, /// pushes null
+	W_OP_INT, /// pushes int_
+	W_OP_FLOAT, /// pushes float_
+	W_OP_STRING, /// pushes a new string with the contents of ast
+	W_OP_CONST, /// pushes a copy of the constant ast
+	// variables
+	W_OP_VAR, /// pushes the variable named by ast
+	W_OP_THIS, /// pushes $this
+	W_OP_INDEX, /// pops right and left, pushes left:right. ast is the index node.
+	W_OP_INDEX_BORROW, /// pushes left:right for the index node ast, whose sides are both inert. variables on either side are borrowed instead of being pushed.
+	// scopes
+	W_OP_ENTER, /// enters a new scope for the nested block ast
+	W_OP_LEAVE, /// leaves the current scope
+	// commands
+	W_OP_LOOKUP, /// looks up the name of cmd through its inline cache. lazy external commands are called right away and jump to arg, anything else is pushed.
+	W_OP_CALL, /// calls the command on top of the stack. lazy external commands are called directly with the AST arguments of cmd and then jump to arg. internal and strict commands fall through to their argument code.
+	W_OP_METHOD, /// same as W_OP_CALL, for a command named receiver:member with a literal member. builtin methods of the receiver on top of the stack are called on it directly, without binding them to it first. anything else is indexed and called.
+	W_OP_ARG, /// skips to the W_OP_INVOKE at arg if the internal command being called takes no more than int_ arguments
+	W_OP_INVOKE, /// invokes the internal or strict command below the evaluated arguments
+	W_OP_TAIL, /// same as W_OP_INVOKE, for calls whose result is the result of the chunk. these can be left to the caller as tail calls.
+	W_OP_POP, /// pops and releases the top value
+	// core builtins, compiled inline behind a W_OP_GUARD
+	W_OP_GUARD, /// skips to the generic code at arg unless the name of cmd still refers to builtin
+	W_OP_ADD, /// pops right and left, pushes left + right. ast is the command's name, used for error positions.
+	W_OP_SUB, /// same as W_OP_ADD, but subtracts
+	W_OP_MUL, /// same as W_OP_ADD, but multiplies
+	W_OP_DIV, /// same as W_OP_ADD, but divides
+	W_OP_MOD, /// same as W_OP_ADD, but takes the modulo
+	W_OP_EQU, /// pops right and left, pushes 1 if they're equal and 0 otherwise
+	W_OP_NEQ, /// same as W_OP_EQU, but pushes 1 if they aren't equal
+	W_OP_LT, /// same as W_OP_EQU, but compares with <
+	W_OP_LTE, /// same as W_OP_EQU, but compares with <=
+	W_OP_GT, /// same as W_OP_EQU, but compares with >
+	W_OP_GTE, /// same as W_OP_EQU, but compares with >=
+	W_OP_JUMP, /// jumps to arg
+	W_OP_JUMP_IF_NOT, /// pops a value, and jumps to arg if it isn't truthy
+	W_OP_LOOP, /// jumps back to arg at the end of an iteration of the loop cmd, taking a step from the budget
+	W_OP_FOR_INIT, /// starts the for loop cmd over the value on top of the stack. lists push an index and a null result, anything else is ran by w_for and jumps to arg with the result.
+	W_OP_FOR_NEXT, /// jumps to arg if the list is exhausted. otherwise pops the last result, enters a scope for the body and binds the loop variables.
+	W_OP_FOR_END, /// pops the result, index and list, and pushes the result back
+	W_OP_RETURN, /// pops a value and returns it from the command being ran
+	W_OP_END /// returns the top value
+} w_opcode_t;
+
+/// A single instruction
+typedef struct w_insn {
+	w_opcode_t op;
+	size_t arg; /// Jump target
+	union {
+		int64_t int_;
+		double float_;
+		w_ast_t *ast; /// Node this was compiled from, used for names and file positions
+		w_ast_command_t *cmd; /// Command this was compiled from (W_OP_LOOKUP, W_OP_CALL, W_OP_METHOD, W_OP_INVOKE, W_OP_GUARD and the W_OP_FOR_* instructions)
+	};
+	w_externcmd_t builtin; /// Lazy builtin a W_OP_GUARD checks for
+	w_strictcmd_t strict; /// Strict builtin a W_OP_GUARD checks for. Only one of builtin and strict is set.
+} w_insn_t;
+
+/// Catches break and continue statuses raised inside an inline loop body
+typedef struct w_handler {
+	size_t start, end; /// Range of instructions making up the loop body
+	size_t stack; /// Stack size to unwind to
+	size_t calls; /// Number of commands whose arguments are being evaluated
+	size_t scopes; /// Scope depth to unwind to (0 being the block's own scope)
+	size_t brk, cont; /// Where break and continue jump to, after pushing null
+} w_handler_t;
+
+typedef struct w_jit w_jit_t;
+
+/// A compiled command block
+struct w_chunk {
+	size_t len; /// Number of instructions
+	w_insn_t *code; /// Instructions
+	size_t max_stack; /// Maximum amount of values on the stack at once
+	size_t max_scopes; /// Maximum amount of nested scopes (including the block's own scope)
+	size_t handlers_len; /// Number of loop handlers
+	w_handler_t *handlers; /// Loop handlers, innermost loops first
+	size_t hits; /// Number of entries and loop iterations, counted while the JIT is on until it tries compiling the chunk
+	w_jit_t *jit; /// Native code, NULL until the chunk gets hot
+	w_native_t *native; /// Code generated ahead of time for the block, NULL if there isn't any
+};
+
+w_chunk_t *w_compile(w_ast_t *ast); /// Compiles a W_AST_COMMANDS node into a chunk.
+void w_chunk_free(w_chunk_t *chunk); /// Frees a chunk
+void w_chunk_print(w_chunk_t *chunk); /// Prints a chunk's instructions (for debugging)
+
+#endif
@@ -1,10 +1,114 @@
+#include <stdio.h>
+#include <time.h>
+
 #include "hashtable.h"
 
+// secrets the hash mixes in, from wyhash
+#define P0 0xa0761d6478bd642fULL
+#define P1 0xe7037ed1a0b428dbULL
+#define P2 0x8ebc6af09c88c6cfULL
+
+// multiplies a and b into 128 bits, and folds the halves together
+static uint64_t mum(uint64_t a, uint64_t b) {
+	#ifdef __SIZEOF_INT128__
+	__uint128_t r = (__uint128_t)a*b;
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+	#else
+	uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+	uint64_t rh = ha*hb, rm0 = ha*lb, rm1 = hb*la, rl = la*lb;
+	uint64_t t = rl+(rm0 << 32), c = t < rl;
+	uint64_t lo = t+(rm1 << 32);
+	c += lo < t;
+	return lo ^ (rh+(rm0 >> 32)+(rm1 >> 32)+c);
+	#endif
+}
+
+static uint64_t read64(char *p) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static uint64_t read32(char *p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static uint64_t seed;
+
+// picks the seed for this process, so that which keys collide can't be known ahead of time
+static void seed_init(void) {
+	FILE *fp = fopen("/dev/urandom", "rb");
+	if(fp != NULL) {
+		if(fread(&seed, sizeof(seed), 1, fp) != 1)
+			seed = 0;
+		fclose(fp);
+	}
+	// fall back on whatever differs between runs where there's no /dev/urandom
+	seed ^= mum((uint64_t)time(NULL) ^ P0, (uint64_t)(uintptr_t)&seed ^ (uint64_t)clock() ^ P1);
+	if(seed == 0)
+		seed = P2;
+}
+
+// wyhash, reading a word at a time
 size_t w_hash(w_astring_t *str) {
-	if(str->len == 0)
-		return 0;
-	size_t h = 37;
-	for(size_t i = 0; i < str->len; i++)
-		h = (h*54059) ^ (str->ptr[i] * 76963);
+	if(str->hash != 0 || str->len == 0)
+		return str->hash;
+	if(seed == 0)
+		seed_init();
+	char *p = str->ptr;
+	size_t len = str->len;
+	uint64_t s = seed ^ mum(seed ^ P0, P1), a, b;
+	if(len <= 16) {
+		if(len >= 4) {
+			// the two reads overlap for lengths that aren't 8 or 16
+			a = (read32(p) << 32) | read32(p+((len >> 3) << 2));
+			b = (read32(p+len-4) << 32) | read32(p+len-4-((len >> 3) << 2));
+		}
+		else {
+			a = ((uint64_t)(uint8_t)p[0] << 16) | ((uint64_t)(uint8_t)p[len >> 1] << 8) | (uint8_t)p[len-1];
+			b = 0;
+		}
+	}
+	else {
+		size_t i = len;
+		for(; i > 16; i -= 16, p += 16)
+			s = mum(read64(p) ^ P1, read64(p+8) ^ s);
+		a = read64(p+i-16);
+		b = read64(p+i-8);
+	}
+	size_t h = mum(P1 ^ len, mum(a ^ P1, b ^ s));
+	if(h == 0)
+		h = 1; // 0 means the hash hasn't been computed
+	str->hash = h;
 	return h;
 }
+
+uint64_t w_bloom(w_astring_t *str) {
+	return (uint64_t)1 << (w_hash(str)>>3)%64;
+}
+
+W_HASHTABLE_H(w_symtable, w_sym_t *, int);
+
+static void symtable_free(int data, w_sym_t **sym) {
+	free(*sym);
+}
+
+static w_sym_t *symtable_clone(int data, w_sym_t **sym) {
+	return *sym;
+}
+
+W_HASHTABLE_C(w_symtable, w_sym_t *, int, symtable_free, symtable_clone);
+
+static w_symtable_t symtable;
+
+w_sym_t *w_intern(w_astring_t *str) {
+	w_sym_t **sym = w_symtable_get(&symtable, str);
+	if(sym != NULL)
+		return *sym;
+	w_sym_t *new = malloc(sizeof(w_sym_t));
+	*new = (w_sym_t){1};
+	w_symtable_set(&symtable, str, new);
+	return new;
+}
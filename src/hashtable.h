@@ -9,143 +9,298 @@
 
 #include "parser.h"
 
-size_t w_hash(w_astring_t *str);
+size_t w_hash(w_astring_t *str); // returns the hash of str, caching it in str->hash. hashes are seeded randomly for each process.
+uint64_t w_bloom(w_astring_t *str); // returns the bit that represents str in a 64 bit bloom filter
 
+// an interned name
+struct w_sym {
+	uint64_t version; // bumped whenever a variable with this name is declared, set, deleted or freed
+};
 
-// TODO: (automatic) hashtable resizing
+w_sym_t *w_intern(w_astring_t *str); // returns the symbol for a name. symbols are never freed.
+
+// hashtables use open addressing. every slot has a control byte, which is either W_CTRL_EMPTY, W_CTRL_DELETED or the low 7 bits of
+// the hash of the slot's key. slots are probed a group of 8 at a time, comparing all of the group's control bytes at once.
+#define W_CTRL_EMPTY 0x80
+#define W_CTRL_DELETED 0xfe
+#define W_GROUP 8
+#define W_GROUP_LSBS 0x0101010101010101ULL
+#define W_GROUP_MSBS 0x8080808080808080ULL
+
+// loads the control bytes of a group, the first one being the lowest byte
+static inline uint64_t w_group_load(uint8_t *ctrl) {
+	uint64_t g;
+	memcpy(&g, ctrl, sizeof(g));
+	#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	g = __builtin_bswap64(g);
+	#endif
+	return g;
+}
+
+// the high bit of each byte of the masks below is set for the slots that match. w_group_match can give false positives, which the
+// comparison of the keys weeds out.
+static inline uint64_t w_group_match(uint64_t g, uint8_t tag) {
+	uint64_t x = g ^ (W_GROUP_LSBS*tag);
+	return (x-W_GROUP_LSBS) & ~x & W_GROUP_MSBS;
+}
+
+static inline uint64_t w_group_empty(uint64_t g) {
+	return g & (~g << 6) & W_GROUP_MSBS;
+}
+
+static inline uint64_t w_group_free(uint64_t g) { // empty or deleted
+	return g & ~(g << 7) & W_GROUP_MSBS;
+}
+
+#define W_GROUP_FIRST(M) ((size_t)__builtin_ctzll(M) >> 3) // index of the first slot in a mask
+
+// number of slots moved out of the old slots of a table by each change while it's being resized
+#define W_REHASH_STEP 32
 
 // DATA is the type of some arbitrary data that is in the hashmap struct
 #define W_HASHTABLE_H(NAME, T, DATA) \
-typedef struct NAME##_list { \
+typedef struct NAME##_entry { \
 	w_astring_t key; /* the key for this value */ \
+	size_t hash; /* w_hash of the key */ \
 	T item; /* the item */ \
-	struct NAME##_list *next; /* next item */ \
-} NAME##_list_t; \
+} NAME##_entry_t; \
  \
 typedef struct NAME { \
-	size_t capacity; /* current capacity (for now this is effectively a constant) */ \
-	NAME##_list_t **ptr; \
+	size_t capacity; /* number of slots, a power of 2 that's at least W_GROUP. 0 until the first set. */ \
+	size_t len; /* number of items, including the ones still in the old slots */ \
+	size_t used; /* number of slots that aren't empty */ \
+	uint8_t *ctrl; /* control byte of each slot */ \
+	NAME##_entry_t *entries; /* entry of each slot */ \
+	/* slots from before the table was resized. their entries are moved over a few at a time, so that no single set has to move all of them. */ \
+	size_t old_capacity; /* 0 once they've all been moved */ \
+	size_t moved; /* number of old slots that have been moved */ \
+	uint8_t *old_ctrl; \
+	NAME##_entry_t *old_entries; \
 	DATA data; \
 } NAME##_t; \
  \
-NAME##_t NAME##_new(size_t capacity, DATA data); /* creates a new hashmap with the given capacity */\
+NAME##_t NAME##_new(size_t capacity, DATA data); /* creates a new hashmap with room for about capacity items before it grows */\
 void NAME##_free(NAME##_t *tbl); /* Frees a hashmap */ \
 void NAME##_set(NAME##_t *tbl, w_astring_t *str, T value); /* sets a value in a hashmap */ \
 void NAME##_setc(NAME##_t *tbl, char *str, T value); /* same as above, except uses a cstring instead */ \
 T *NAME##_get(NAME##_t *tbl, w_astring_t *str); /* gets a value from a hashmap. returns NULL if it doesn't exist */\
-T *NAME##_gets(NAME##_t *tbl, char *str); /* same as above, except uses a cstring instead */\
+T *NAME##_getc(NAME##_t *tbl, char *str); /* same as above, except uses a cstring instead */\
 void NAME##_del(NAME##_t *tbl, w_astring_t *str); /* deletes a value from a hashmap */ \
 void NAME##_delc(NAME##_t *tbl, char *str); /* same as above, except uses a cstring instead */ \
-NAME##_t NAME##_clone(NAME##_t *tbl, DATA new_data);
+NAME##_t NAME##_clone(NAME##_t *tbl, DATA new_data); \
+/* moves on to the next entry after the position *it (which starts out at 0), pointing key and item at it. returns false once there are \
+   none left. entries set or deleted along the way may or may not be visited. */ \
+bool NAME##_next(NAME##_t *tbl, size_t *it, w_astring_t **key, T **item);
 
 // FREE and CLONE are freeing and cloning functions. They are both called with the data and an item.
 #define W_HASHTABLE_C(NAME, T, DATA, FREE, CLONE) \
-NAME##_t NAME##_new(size_t capacity, DATA data) { \
-	NAME##_list_t **ptr = malloc(sizeof(NAME##_list_t *)*capacity); \
-	for(size_t i = 0; i < capacity; i++) \
-		ptr[i] = NULL; \
-	return (NAME##_t){capacity, ptr, data}; \
+/* finds the slot of a key among capacity slots, returning SIZE_MAX if it's not there */ \
+static size_t NAME##_find(size_t capacity, uint8_t *ctrl, NAME##_entry_t *entries, w_astring_t *str, size_t hash) { \
+	if(capacity == 0) \
+		return SIZE_MAX; \
+	size_t mask = capacity/W_GROUP-1, g = (hash >> 7) & mask; \
+	for(size_t step = 1; ; step++) { \
+		uint64_t group = w_group_load(&ctrl[g*W_GROUP]); \
+		for(uint64_t m = w_group_match(group, hash & 0x7f); m != 0; m &= m-1) { \
+			size_t i = g*W_GROUP+W_GROUP_FIRST(m); \
+			if(entries[i].hash == hash && w_astreq(&entries[i].key, str)) \
+				return i; \
+		} \
+		if(w_group_empty(group) != 0) \
+			return SIZE_MAX; \
+		g = (g+step) & mask; /* visits every group, since the number of groups is a power of 2 */ \
+	} \
+} \
+/* puts an entry whose key isn't in the table yet into a free slot */ \
+static void NAME##_insert(NAME##_t *tbl, NAME##_entry_t entry) { \
+	size_t mask = tbl->capacity/W_GROUP-1, g = (entry.hash >> 7) & mask; \
+	for(size_t step = 1; ; step++) { \
+		uint64_t m = w_group_free(w_group_load(&tbl->ctrl[g*W_GROUP])); \
+		if(m != 0) { \
+			size_t i = g*W_GROUP+W_GROUP_FIRST(m); \
+			if(tbl->ctrl[i] == W_CTRL_EMPTY) \
+				tbl->used++; \
+			tbl->ctrl[i] = entry.hash & 0x7f; \
+			tbl->entries[i] = entry; \
+			return; \
+		} \
+		g = (g+step) & mask; \
+	} \
+} \
+/* moves up to n of the old slots into the new ones. it stops early if the new ones are getting full, leaving the rest for the \
+   next resize. */ \
+static void NAME##_rehash(NAME##_t *tbl, size_t n) { \
+	for(; n > 0 && tbl->moved < tbl->old_capacity; n--, tbl->moved++) { \
+		size_t i = tbl->moved; \
+		if(tbl->old_ctrl[i] & 0x80) \
+			continue; \
+		if((tbl->used+1)*8 > tbl->capacity*7) \
+			return; \
+		tbl->old_ctrl[i] = W_CTRL_DELETED; \
+		NAME##_insert(tbl, tbl->old_entries[i]); \
+	} \
+	if(tbl->old_capacity != 0 && tbl->moved == tbl->old_capacity) { \
+		free(tbl->old_ctrl); \
+		free(tbl->old_entries); \
+		tbl->old_ctrl = NULL; \
+		tbl->old_entries = NULL; \
+		tbl->old_capacity = 0; \
+	} \
+} \
+/* starts moving the items over to capacity new slots. if the last resize is still going, everything gets moved at once instead. */ \
+static void NAME##_resize(NAME##_t *tbl, size_t capacity) { \
+	NAME##_t old = *tbl; \
+	tbl->capacity = capacity; \
+	tbl->used = 0; \
+	tbl->ctrl = malloc(capacity); \
+	memset(tbl->ctrl, W_CTRL_EMPTY, capacity); \
+	tbl->entries = malloc(sizeof(NAME##_entry_t)*capacity); \
+	tbl->old_capacity = old.capacity; \
+	tbl->old_ctrl = old.ctrl; \
+	tbl->old_entries = old.entries; \
+	tbl->moved = 0; \
+	if(old.old_capacity == 0) \
+		return; \
+	for(size_t i = old.moved; i < old.old_capacity; i++) { \
+		if(!(old.old_ctrl[i] & 0x80)) \
+			NAME##_insert(tbl, old.old_entries[i]); \
+	} \
+	free(old.old_ctrl); \
+	free(old.old_entries); \
+	NAME##_rehash(tbl, SIZE_MAX); \
+} \
+/* number of slots for len items, keeping tables at most half full after they're resized */ \
+static size_t NAME##_capacity(size_t len) { \
+	size_t capacity = W_GROUP; \
+	while(capacity < len*2) \
+		capacity *= 2; \
+	return capacity; \
 } \
-static void NAME##_list_free(DATA d, NAME##_list_t *l) { \
-	free(l->key.ptr); \
-	FREE(d, &l->item); \
-	free(l); \
+NAME##_t NAME##_new(size_t capacity, DATA data) { \
+	NAME##_t tbl = (NAME##_t){.data = data}; \
+	if(capacity != 0) \
+		NAME##_resize(&tbl, NAME##_capacity(capacity)); \
+	return tbl; \
 } \
 void NAME##_free(NAME##_t *tbl) { \
 	for(size_t i = 0; i < tbl->capacity; i++) { \
-		NAME##_list_t *curr = tbl->ptr[i]; \
-		while(curr != NULL) { \
-			NAME##_list_t *next = curr->next; \
-			NAME##_list_free(tbl->data, curr); \
-			curr = next; \
-		} \
+		if(tbl->ctrl[i] & 0x80) \
+			continue; \
+		free(tbl->entries[i].key.ptr); \
+		FREE(tbl->data, &tbl->entries[i].item); \
+	} \
+	for(size_t i = tbl->moved; i < tbl->old_capacity; i++) { \
+		if(tbl->old_ctrl[i] & 0x80) \
+			continue; \
+		free(tbl->old_entries[i].key.ptr); \
+		FREE(tbl->data, &tbl->old_entries[i].item); \
 	} \
-	free(tbl->ptr); \
+	free(tbl->ctrl); \
+	free(tbl->entries); \
+	free(tbl->old_ctrl); \
+	free(tbl->old_entries); \
 } \
 void NAME##_set(NAME##_t *tbl, w_astring_t *str, T value) { \
-	size_t hash = w_hash(str)%tbl->capacity; \
-	NAME##_list_t *curr = tbl->ptr[hash], *prev = curr; \
-	while(curr != NULL) { \
-		if(w_astreq(str, &curr->key)) { \
-			curr->item = value; \
-			return; \
-		} \
-		prev = curr; \
-		curr = curr->next; \
+	size_t hash = w_hash(str); \
+	size_t i = NAME##_find(tbl->capacity, tbl->ctrl, tbl->entries, str, hash); \
+	if(i != SIZE_MAX) { \
+		tbl->entries[i].item = value; \
+		return; \
 	} \
-	NAME##_list_t *node = malloc(sizeof(NAME##_list_t)); \
-	*node = (NAME##_list_t){w_astrdup(str), value, NULL}; \
-	if(prev == NULL) { \
-		tbl->ptr[hash] = node; \
+	i = NAME##_find(tbl->old_capacity, tbl->old_ctrl, tbl->old_entries, str, hash); \
+	if(i != SIZE_MAX) { \
+		tbl->old_entries[i].item = value; \
 		return; \
 	} \
-	prev->next = node; \
+	/* at most 7/8 of the slots can be used, so that probing always reaches an empty one */ \
+	if(tbl->capacity == 0 || (tbl->used+1)*8 > tbl->capacity*7) \
+		NAME##_resize(tbl, NAME##_capacity(tbl->len+1)); \
+	NAME##_insert(tbl, (NAME##_entry_t){w_astrdup(str), hash, value}); \
+	tbl->len++; \
+	NAME##_rehash(tbl, W_REHASH_STEP); \
 } \
 void NAME##_setc(NAME##_t *tbl, char *str, T value) { \
 	w_astring_t a = (w_astring_t){strlen(str), str}; \
 	NAME##_set(tbl, &a, value); \
 } \
 T *NAME##_get(NAME##_t *tbl, w_astring_t *str) { \
-	size_t hash = w_hash(str)%tbl->capacity; \
-	NAME##_list_t *curr = tbl->ptr[hash]; \
-	while(true) { \
-		if(curr == NULL) \
-			return NULL; \
-		if(w_astreq(str, &curr->key)) \
-			return &curr->item; \
-		curr = curr->next; \
-	} \
+	size_t hash = w_hash(str); \
+	size_t i = NAME##_find(tbl->capacity, tbl->ctrl, tbl->entries, str, hash); \
+	if(i != SIZE_MAX) \
+		return &tbl->entries[i].item; \
+	i = NAME##_find(tbl->old_capacity, tbl->old_ctrl, tbl->old_entries, str, hash); \
+	if(i != SIZE_MAX) \
+		return &tbl->old_entries[i].item; \
+	return NULL; \
 } \
 T *NAME##_getc(NAME##_t *tbl, char *str) { \
 	w_astring_t a = (w_astring_t){strlen(str), str}; \
 	return NAME##_get(tbl, &a); \
 } \
 void NAME##_del(NAME##_t *tbl, w_astring_t *str) { \
-	size_t hash = w_hash(str)%tbl->capacity; \
-	NAME##_list_t *curr = tbl->ptr[hash], *prev = NULL; \
-	if(curr == NULL) \
-		return; \
-	while(true) { \
-		if(w_astreq(str, &curr->key)) { \
-			if(prev == NULL) \
-				tbl->ptr[hash] = curr->next; \
-			else \
-				prev->next = curr->next; \
-			NAME##_list_free(tbl->data, curr); \
+	size_t hash = w_hash(str); \
+	uint8_t *ctrl = tbl->ctrl; \
+	NAME##_entry_t *entries = tbl->entries; \
+	size_t i = NAME##_find(tbl->capacity, ctrl, entries, str, hash); \
+	if(i == SIZE_MAX) { \
+		ctrl = tbl->old_ctrl; \
+		entries = tbl->old_entries; \
+		i = NAME##_find(tbl->old_capacity, ctrl, entries, str, hash); \
+		if(i == SIZE_MAX) \
 			return; \
-		} \
-		prev = curr; \
-		curr = curr->next;  \
 	} \
+	/* the slot can go back to being empty if its group never filled up, since no probe went past it then */ \
+	size_t g = i/W_GROUP*W_GROUP; \
+	if(w_group_empty(w_group_load(&ctrl[g])) != 0) { \
+		ctrl[i] = W_CTRL_EMPTY; \
+		if(ctrl == tbl->ctrl) \
+			tbl->used--; \
+	} \
+	else \
+		ctrl[i] = W_CTRL_DELETED; \
+	free(entries[i].key.ptr); \
+	FREE(tbl->data, &entries[i].item); \
+	tbl->len--; \
+	if(tbl->old_capacity == 0 && tbl->capacity > W_GROUP && tbl->len*8 < tbl->capacity) \
+		NAME##_resize(tbl, NAME##_capacity(tbl->len)); \
+	NAME##_rehash(tbl, W_REHASH_STEP); \
 } \
 void NAME##_delc(NAME##_t *tbl, char *str) { \
 	w_astring_t a = (w_astring_t){strlen(str), str}; \
 	NAME##_del(tbl, &a); \
 } \
-static NAME##_list_t *NAME##_list_clone(DATA d, NAME##_list_t *old) { \
-	NAME##_list_t *new = malloc(sizeof(NAME##_list_t)); \
-	*new = (NAME##_list_t){w_astrdup(&old->key), CLONE(d, &old->item), NULL}; \
-	return new; \
-} \
 NAME##_t NAME##_clone(NAME##_t *tbl, DATA new_data) { \
-	NAME##_t ret = NAME##_new(tbl->capacity, new_data); \
-	for(size_t i = 0; i < ret.capacity; i++) { \
-		NAME##_list_t *old = tbl->ptr[i]; \
-		if(old == NULL) { \
-			ret.ptr[i] = NULL; \
-			continue; \
-		} \
-		NAME##_list_t *new = NAME##_list_clone(tbl->data, old), *head = new; \
-		while(true) { \
-			old = old->next; \
-			if(old == NULL) \
-				break; \
-			new->next = NAME##_list_clone(tbl->data, old); \
-			new = new->next; \
-		} \
-		ret.ptr[i] = head; \
+	NAME##_t ret = NAME##_new(tbl->len, new_data); \
+	for(size_t i = 0; i < tbl->capacity; i++) { \
+		NAME##_entry_t *e = &tbl->entries[i]; \
+		if(!(tbl->ctrl[i] & 0x80)) \
+			NAME##_insert(&ret, (NAME##_entry_t){w_astrdup(&e->key), e->hash, CLONE(tbl->data, &e->item)}); \
 	} \
+	for(size_t i = tbl->moved; i < tbl->old_capacity; i++) { \
+		NAME##_entry_t *e = &tbl->old_entries[i]; \
+		if(!(tbl->old_ctrl[i] & 0x80)) \
+			NAME##_insert(&ret, (NAME##_entry_t){w_astrdup(&e->key), e->hash, CLONE(tbl->data, &e->item)}); \
+	} \
+	ret.len = tbl->len; \
 	return ret; \
+} \
+bool NAME##_next(NAME##_t *tbl, size_t *it, w_astring_t **key, T **item) { \
+	for(; *it < tbl->capacity; (*it)++) { \
+		if(tbl->ctrl[*it] & 0x80) \
+			continue; \
+		*key = &tbl->entries[*it].key; \
+		*item = &tbl->entries[(*it)++].item; \
+		return true; \
+	} \
+	for(; *it-tbl->capacity < tbl->old_capacity; (*it)++) { \
+		size_t i = *it-tbl->capacity; \
+		if(i < tbl->moved || tbl->old_ctrl[i] & 0x80) \
+			continue; \
+		*key = &tbl->old_entries[i].key; \
+		*item = &tbl->old_entries[(*it)++ - tbl->capacity].item; \
+		return true; \
+	} \
+	return false; \
 }
 
 #endif
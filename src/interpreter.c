@@ -3,9 +3,19 @@
 #include <stdio.h>
 #include <inttypes.h>
 #include <math.h>
+#include <time.h>
 
 #include "commands.h"
 #include "interpreter.h"
+#include "vm.h"
+
+w_options_t w_options = {
+	.vm = true,
+	.jit = false,
+	.jit_hot = 64,
+	.fold = true,
+	.lazy = false
+};
 
 char *w_typename(w_value_type_t type) {
 	switch(type) {
@@ -25,6 +35,8 @@ char *w_typename(w_value_type_t type) {
 			return "list";
 		case W_VALUE_MAP:
 			return "map";
+		case W_VALUE_UNSET:
+			return "unset";
 	}
 }
 
@@ -48,18 +60,20 @@ void w_value_release(w_value_t *val) {
 		}
 		case W_VALUE_MAP: {
 			w_map_t *m = val->map;
-			if(--m->data == 0) {
+			if(--m->refcount == 0)
 				w_map_free(m);
-				free(m);
-			}
 			break;
 		}
 		case W_VALUE_EXTERNCMD: {
 			w_ecmd_t *c = val->externcmd;
 			if(--c->refcount == 0) {
-				if(c->obj != NULL)
-					w_value_release(c->obj);
-				free(c->obj);
+				if(c->drop != NULL)
+					c->drop(c->obj);
+				else {
+					if(c->obj != NULL)
+						w_value_release(c->obj);
+					free(c->obj);
+				}
 				free(c);
 			}
 			break;
@@ -73,7 +87,8 @@ void w_value_release(w_value_t *val) {
 				for(size_t i = 0; i < c->argc; i++)
 					free(c->args[i].name.ptr);
 				free(c->args);
-				w_ast_free(&c->impl);
+				if(c->tree != NULL)
+					w_tree_release(c->tree);
 				free(c);
 			}
 		}
@@ -89,7 +104,7 @@ void w_value_ref(w_value_t *val) {
 			val->list->refcount++;
 			break;
 		case W_VALUE_MAP:
-			val->map->data++;
+			val->map->refcount++;
 			break;
 		case W_VALUE_EXTERNCMD:
 			val->externcmd->refcount++;
@@ -120,7 +135,8 @@ static void value_tostring(bool toplevel, w_writer_t *w, w_value_t *val) {
 		}
 		case W_VALUE_EXTERNCMD: {
 			char buf[256];
-			snprintf(buf, 256, "<externcmd @ %p>", val->externcmd->cmd);
+			w_ecmd_t *ecmd = val->externcmd;
+			snprintf(buf, 256, "<externcmd @ %p>", ecmd->strict != NULL ? (void *)ecmd->strict : (void *)ecmd->cmd);
 			w_writer_putcs(w, buf);
 			break;
 		}
@@ -140,17 +156,15 @@ static void value_tostring(bool toplevel, w_writer_t *w, w_value_t *val) {
 			w_writer_putch(w, ']');
 			break;
 		case W_VALUE_MAP: {
-			w_map_t *map = val->map;
 			w_writer_putcs(w, "[map");
-			for(size_t i = 0; i < map->capacity; i++) {
-				w_map_list_t *curr = map->ptr[i];
-				while(curr != NULL) {
-					w_writer_putch(w, ' ');
-					w_writer_puts(w, curr->key.len, curr->key.ptr);
-					w_writer_putch(w, ' ');
-					value_tostring(false, w, &curr->item);
-					curr = curr->next;
-				}
+			w_map_iter_t it = {};
+			w_astring_t *key;
+			w_value_t *item;
+			while(w_map_next(val->map, &it, &key, &item)) {
+				w_writer_putch(w, ' ');
+				w_writer_puts(w, key->len, key->ptr);
+				w_writer_putch(w, ' ');
+				value_tostring(false, w, item);
 			}
 			w_writer_putch(w, ']');
 			break;
@@ -245,9 +259,7 @@ void w_value_print(w_value_t *val, FILE *fp) {
 void w_hack_set_value(w_value_t *a, w_value_t *b) {
 	*a = *b;
 }
-w_value_t *w_hack_malloc_value(void) {
-	return malloc(sizeof(w_value_t));
-}
+_Static_assert(sizeof(w_value_t) <= sizeof(((w_status_t *)NULL)->ret), "w_status_t.ret is too small to hold a value");
 
 #define OPERATION(OP, FOP) { \
 	if(a->type == W_VALUE_INT && b->type == W_VALUE_INT) \
@@ -328,7 +340,13 @@ bool w_value_gte(w_ctx_t *ctx, w_value_t *a, w_value_t *b) OPERATION(>=)
 #define EPSILON (0.00001)
 #define FEQUAL(A, B) ((A-B) > -EPSILON && (A-B) < EPSILON)
 
-bool w_value_equal(w_value_t *a, w_value_t *b) {
+// whether a float is exactly an int, the way w_value_hash sees it
+static bool float_is_int(double f, int64_t i) {
+	return f == floor(f) && f >= -9.2e18 && f <= 9.2e18 && (int64_t)f == i;
+}
+
+// compares two values. exact compares numbers exactly instead of to within epsilon.
+static bool value_equal(w_value_t *a, w_value_t *b, bool exact) {
 	switch(a->type) {
 		case W_VALUE_NULL:
 			return b->type == W_VALUE_NULL;
@@ -337,16 +355,16 @@ bool w_value_equal(w_value_t *a, w_value_t *b) {
 				case W_VALUE_INT:
 					return a->int_ == b->int_;
 				case W_VALUE_FLOAT:
-					return FEQUAL(a->int_, b->float_);
+					return exact ? float_is_int(b->float_, a->int_) : FEQUAL(a->int_, b->float_);
 				default:
 					return false;
 			}
 		case W_VALUE_FLOAT:
 			switch(b->type) {
 				case W_VALUE_INT:
-					return FEQUAL(a->float_, b->int_);
+					return exact ? float_is_int(a->float_, b->int_) : FEQUAL(a->float_, b->int_);
 				case W_VALUE_FLOAT:
-					return FEQUAL(a->float_, b->float_);
+					return exact ? a->float_ == b->float_ : FEQUAL(a->float_, b->float_);
 				default:
 					return false;
 			}
@@ -378,16 +396,92 @@ bool w_value_equal(w_value_t *a, w_value_t *b) {
 			if(la->len != lb->len)
 				return false;
 			for(size_t i = 0; i < la->len; i++)
-				if(w_value_equal(&la->ptr[i], &lb->ptr[i]))
+				if(!value_equal(&la->ptr[i], &lb->ptr[i], exact))
 					return false;
 			return true;
 		}
 		case W_VALUE_MAP: {
 			if(b->type != W_VALUE_MAP)
 				return false;
-			// TODO: full implementation
-			return a->map == b->map;
+			if(a->map == b->map)
+				return true;
+			// every entry of a has to be in b, and b can't have any others
+			size_t len = 0;
+			w_map_iter_t it = {};
+			w_astring_t *key;
+			w_value_t *item;
+			while(w_map_next(a->map, &it, &key, &item)) {
+				w_value_t *v = w_map_get(b->map, key);
+				if(v == NULL || !value_equal(item, v, exact))
+					return false;
+				len++;
+			}
+			it = (w_map_iter_t){};
+			while(w_map_next(b->map, &it, &key, &item))
+				if(len-- == 0)
+					return false;
+			return len == 0;
+		}
+	}
+}
+
+bool w_value_equal(w_value_t *a, w_value_t *b) {
+	return value_equal(a, b, false);
+}
+
+bool w_value_same(w_value_t *a, w_value_t *b) {
+	return value_equal(a, b, true);
+}
+
+// scrambles the bits of a hash, so that similar values end up far apart
+static uint64_t mix(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+uint64_t w_value_hash(w_value_t *v) {
+	switch(v->type) {
+		case W_VALUE_INT:
+			return mix(v->int_);
+		case W_VALUE_FLOAT: {
+			// whole floats are equal to ints
+			double f = v->float_;
+			if(f == floor(f) && f >= -9.2e18 && f <= 9.2e18)
+				return mix((int64_t)f);
+			uint64_t bits;
+			memcpy(&bits, &f, sizeof(bits));
+			return mix(bits ^ W_VALUE_FLOAT);
+		}
+		case W_VALUE_EXTERNCMD:
+			return mix((uintptr_t)v->externcmd);
+		case W_VALUE_COMMAND:
+			return mix((uintptr_t)v->cmd);
+		case W_VALUE_STRING: {
+			w_astring_t s = w_string_key(v->string);
+			return mix(s.hash ^ W_VALUE_STRING);
+		}
+		case W_VALUE_LIST: {
+			uint64_t h = W_VALUE_LIST;
+			for(size_t i = 0; i < v->list->len; i++)
+				h = mix(h+w_value_hash(&v->list->ptr[i]));
+			return h;
+		}
+		case W_VALUE_MAP: {
+			// entries are summed, since maps with the same entries can have them in different orders
+			uint64_t h = W_VALUE_MAP;
+			w_map_iter_t it = {};
+			w_astring_t *key;
+			w_value_t *item;
+			while(w_map_next(v->map, &it, &key, &item))
+				h += mix(w_hash(key)+w_value_hash(item));
+			return mix(h);
 		}
+		default:
+			return mix(v->type);
 	}
 }
 //	W_VALUE_NULL, // null value
@@ -422,6 +516,12 @@ char *w_cstring(w_string_t *str) {
 	return cstr;
 }
 
+w_astring_t w_string_key(w_string_t *str) {
+	w_astring_t key = (w_astring_t){str->len, str->ptr, str->hash};
+	str->hash = w_hash(&key);
+	return key;
+}
+
 bool w_streqc(w_string_t *a, char *b) {
 	size_t blen = strlen(b);
 	if(a->len != blen)
@@ -454,15 +554,102 @@ static w_value_t string_get(w_ctx_t *ctx, w_string_t *s, int64_t idx) {
 	return (w_value_t){.type = W_VALUE_STRING, .string = str};
 }
 
-w_value_t w_value_index(w_ctx_t *ctx, w_value_t *left, w_value_t *right) {
-	#define CMD(NAME) do { \
-		w_ecmd_t *ecmd = malloc(sizeof(w_ecmd_t)); \
-		w_value_t *v = malloc(sizeof(w_value_t)); \
-		*v = *left; \
-		w_value_ref(v); \
-		*ecmd = (w_ecmd_t){1, &w_cmd_##NAME, v}; \
-		return (w_value_t){.type = W_VALUE_EXTERNCMD, .externcmd = ecmd}; \
-	} while(0)
+// names of the builtin members
+static struct {
+	char *name;
+	size_t len;
+} members[W_MEMBERS] = {
+	#define M(MEMBER, NAME) [W_MEMBER_##MEMBER] = {NAME, sizeof(NAME)-1}
+	M(LEN, "len"),
+	M(SET_MUT, "set!"), M(SET, "set"),
+	M(SLICE_MUT, "slice!"), M(SLICE, "slice"),
+	M(DUP_MUT, "dup!"), M(DUP, "dup"),
+	M(SPLIT, "split"),
+	M(REVERSE_MUT, "reverse!"), M(REVERSE, "reverse"),
+	M(CAT_MUT, "cat!"), M(CAT, "cat"),
+	M(CLONE, "clone"),
+	M(PUSH_MUT, "push!"), M(PUSH, "push"),
+	M(UNSHIFT_MUT, "unshift!"), M(UNSHIFT, "unshift"),
+	M(POP_MUT, "pop!"), M(POP, "pop"),
+	M(SHIFT_MUT, "shift!"), M(SHIFT, "shift"),
+	M(FILL_MUT, "fill!"), M(FILL, "fill"),
+	M(DEL_MUT, "del!"), M(DEL, "del")
+	#undef M
+};
+
+// perfect hash of the member names: no two of them land in the same one of 64 slots. names have at least 2 characters.
+#define MEMBER_HASH(P, LEN) (((LEN)+(uint8_t)(P)[0]+(uint8_t)(P)[1]+5*(uint8_t)(P)[(LEN)-1])%64)
+
+w_member_t w_member_find(w_astring_t *name) {
+	static uint8_t slots[64]; // member in each slot of the hash, W_MEMBER_NONE for empty ones
+	if(slots[MEMBER_HASH("len", 3)] == W_MEMBER_NONE)
+		for(w_member_t m = W_MEMBER_LEN; m < W_MEMBERS; m++)
+			slots[MEMBER_HASH(members[m].name, members[m].len)] = m;
+	if(name->len < 2)
+		return W_MEMBER_NONE;
+	w_member_t m = slots[MEMBER_HASH(name->ptr, name->len)];
+	if(m == W_MEMBER_NONE || members[m].len != name->len || memcmp(members[m].name, name->ptr, name->len) != 0)
+		return W_MEMBER_NONE;
+	return m;
+}
+
+#undef MEMBER_HASH
+
+// builtin methods of each type with any, by member
+static w_strictcmd_t string_methods[W_MEMBERS] = {
+	[W_MEMBER_SET_MUT] = &w_cmd_string_set_mut, [W_MEMBER_SET] = &w_cmd_string_set,
+	[W_MEMBER_SLICE_MUT] = &w_cmd_string_slice_mut, [W_MEMBER_SLICE] = &w_cmd_string_slice,
+	[W_MEMBER_DUP_MUT] = &w_cmd_string_dup_mut, [W_MEMBER_DUP] = &w_cmd_string_dup,
+	[W_MEMBER_SPLIT] = &w_cmd_string_split,
+	[W_MEMBER_REVERSE_MUT] = &w_cmd_string_reverse_mut, [W_MEMBER_REVERSE] = &w_cmd_string_reverse,
+	[W_MEMBER_CAT_MUT] = &w_cmd_string_cat_mut, [W_MEMBER_CAT] = &w_cmd_string_cat
+};
+
+static w_strictcmd_t list_methods[W_MEMBERS] = {
+	[W_MEMBER_SET_MUT] = &w_cmd_list_set_mut, [W_MEMBER_SET] = &w_cmd_list_set,
+	[W_MEMBER_CLONE] = &w_cmd_clone,
+	[W_MEMBER_PUSH_MUT] = &w_cmd_list_push_mut, [W_MEMBER_PUSH] = &w_cmd_list_push,
+	[W_MEMBER_UNSHIFT_MUT] = &w_cmd_list_unshift_mut, [W_MEMBER_UNSHIFT] = &w_cmd_list_unshift,
+	[W_MEMBER_POP_MUT] = &w_cmd_list_pop_mut, [W_MEMBER_POP] = &w_cmd_list_pop,
+	[W_MEMBER_SHIFT_MUT] = &w_cmd_list_shift_mut, [W_MEMBER_SHIFT] = &w_cmd_list_shift,
+	[W_MEMBER_SLICE_MUT] = &w_cmd_list_slice_mut, [W_MEMBER_SLICE] = &w_cmd_list_slice,
+	[W_MEMBER_CAT_MUT] = &w_cmd_list_cat_mut, [W_MEMBER_CAT] = &w_cmd_list_cat,
+	[W_MEMBER_FILL_MUT] = &w_cmd_list_fill_mut, [W_MEMBER_FILL] = &w_cmd_list_fill,
+	[W_MEMBER_DUP_MUT] = &w_cmd_list_dup_mut, [W_MEMBER_DUP] = &w_cmd_list_dup,
+	[W_MEMBER_REVERSE_MUT] = &w_cmd_list_reverse_mut, [W_MEMBER_REVERSE] = &w_cmd_list_reverse
+};
+
+static w_strictcmd_t map_methods[W_MEMBERS] = {
+	[W_MEMBER_SET_MUT] = &w_cmd_map_set_mut, [W_MEMBER_SET] = &w_cmd_map_set,
+	[W_MEMBER_CLONE] = &w_cmd_clone,
+	[W_MEMBER_DEL_MUT] = &w_cmd_map_del_mut, [W_MEMBER_DEL] = &w_cmd_map_del
+};
+
+w_strictcmd_t w_value_method(w_value_type_t type, w_member_t member) {
+	switch(type) {
+		case W_VALUE_STRING:
+			return string_methods[member];
+		case W_VALUE_LIST:
+			return list_methods[member];
+		case W_VALUE_MAP:
+			return map_methods[member];
+		default:
+			return NULL;
+	}
+}
+
+// indexes left with right, whose builtin member is member if right is a string
+static w_value_t value_index(w_ctx_t *ctx, w_value_t *left, w_value_t *right, w_member_t member) {
+	w_strictcmd_t method = w_value_method(left->type, member);
+	if(method != NULL) {
+		// bind the method to a reference of left
+		w_ecmd_t *ecmd = malloc(sizeof(w_ecmd_t));
+		w_value_t *v = malloc(sizeof(w_value_t));
+		*v = *left;
+		w_value_ref(v);
+		*ecmd = (w_ecmd_t){1, NULL, v, method, false};
+		return (w_value_t){.type = W_VALUE_EXTERNCMD, .externcmd = ecmd};
+	}
 	switch(left->type) {
 		case W_VALUE_STRING:
 			switch(right->type) {
@@ -472,30 +659,8 @@ w_value_t w_value_index(w_ctx_t *ctx, w_value_t *left, w_value_t *right) {
 					return string_get(ctx, left->string, right->float_);
 				case W_VALUE_STRING: {
 					w_string_t *str = right->string;
-					if(w_streqc(str, "len"))
+					if(member == W_MEMBER_LEN)
 						return (w_value_t){.type = W_VALUE_INT, .int_ = (int64_t)left->string->len};
-					if(w_streqc(str, "set!"))
-						CMD(string_set_mut);
-					if(w_streqc(str, "set"))
-						CMD(string_set);
-					if(w_streqc(str, "slice!"))
-						CMD(string_slice_mut);
-					if(w_streqc(str, "slice"))
-						CMD(string_slice);
-					if(w_streqc(str, "dup!"))
-						CMD(string_dup_mut);
-					if(w_streqc(str, "dup"))
-						CMD(string_dup);
-					if(w_streqc(str, "split"))
-						CMD(string_split);
-					if(w_streqc(str, "reverse!"))
-						CMD(string_reverse_mut);
-					if(w_streqc(str, "reverse"))
-						CMD(string_reverse);
-					if(w_streqc(str, "cat!"))
-						CMD(string_cat_mut);
-					if(w_streqc(str, "cat"))
-						CMD(string_cat);
 					char *cstr = w_cstring(str);
 					w_status_err(ctx->status, w_error_new((w_filepos_t){}, "No member '%s' in string.", cstr));
 					free(cstr);
@@ -510,52 +675,8 @@ w_value_t w_value_index(w_ctx_t *ctx, w_value_t *left, w_value_t *right) {
 					return list_get(ctx, left->list, floor(right->float_));
 				case W_VALUE_STRING: {
 					w_string_t *str = right->string;
-					// maybe I should make a hashtable of builtin functions to speed this up, since this is effectively just linear search
-					// TODO
-					if(w_streqc(str, "len"))
+					if(member == W_MEMBER_LEN)
 						return (w_value_t){.type = W_VALUE_INT, .int_ = (int64_t)left->list->len};
-					if(w_streqc(str, "set!"))
-						CMD(list_set_mut);
-					if(w_streqc(str, "set"))
-						CMD(list_set);
-					if(w_streqc(str, "clone"))
-						CMD(clone);
-					if(w_streqc(str, "push!"))
-						CMD(list_push_mut);
-					if(w_streqc(str, "push"))
-						CMD(list_push);
-					if(w_streqc(str, "unshift!"))
-						CMD(list_unshift_mut);
-					if(w_streqc(str, "unshift"))
-						CMD(list_unshift);
-					if(w_streqc(str, "pop!"))
-						CMD(list_pop_mut);
-					if(w_streqc(str, "pop"))
-						CMD(list_pop);
-					if(w_streqc(str, "shift!"))
-						CMD(list_shift_mut);
-					if(w_streqc(str, "shift"))
-						CMD(list_shift);
-					if(w_streqc(str, "slice!"))
-						CMD(list_slice_mut);
-					if(w_streqc(str, "slice"))
-						CMD(list_slice);
-					if(w_streqc(str, "cat!"))
-						CMD(list_cat_mut);
-					if(w_streqc(str, "cat"))
-						CMD(list_cat);
-					if(w_streqc(str, "fill!"))
-						CMD(list_fill_mut);
-					if(w_streqc(str, "fill"))
-						CMD(list_fill);
-					if(w_streqc(str, "dup!"))
-						CMD(list_dup_mut);
-					if(w_streqc(str, "dup"))
-						CMD(list_dup);
-					if(w_streqc(str, "reverse!"))
-						CMD(list_reverse_mut);
-					if(w_streqc(str, "reverse"))
-						CMD(list_reverse);
 					char *cstr = w_cstring(str);
 					w_status_err(ctx->status, w_error_new((w_filepos_t){}, "No member '%s' in list.", cstr));
 					free(cstr);
@@ -567,17 +688,7 @@ w_value_t w_value_index(w_ctx_t *ctx, w_value_t *left, w_value_t *right) {
 			switch(right->type) {
 				case W_VALUE_STRING: {
 					w_string_t *str = right->string;
-					if(w_streqc(str, "set!"))
-						CMD(map_set_mut);
-					if(w_streqc(str, "set"))
-						CMD(map_set);
-					else if(w_streqc(str, "clone"))
-						CMD(clone);
-					else if(w_streqc(str, "del!"))
-						CMD(map_del_mut);
-					else if(w_streqc(str, "del"))
-						CMD(map_del);
-					w_astring_t astr = (w_astring_t){str->len, str->ptr};
+					w_astring_t astr = w_string_key(str);
 					w_value_t *val = w_map_get(left->map, &astr);
 					if(val == NULL) {
 						char *cstr = w_cstring(str);
@@ -593,7 +704,15 @@ w_value_t w_value_index(w_ctx_t *ctx, w_value_t *left, w_value_t *right) {
 	}
 	w_status_err(ctx->status, w_error_new((w_filepos_t){}, "Can not index %s with %s.", w_typename(left->type), w_typename(right->type)));
 	return (w_value_t){};
-	#undef CMD
+}
+
+w_value_t w_value_index(w_ctx_t *ctx, w_value_t *left, w_value_t *right) {
+	w_member_t member = W_MEMBER_NONE;
+	if(right->type == W_VALUE_STRING) {
+		w_astring_t astr = (w_astring_t){right->string->len, right->string->ptr};
+		member = w_member_find(&astr);
+	}
+	return value_index(ctx, left, right, member);
 }
 
 w_value_t w_value_clone(w_value_t *v) {
@@ -615,82 +734,382 @@ w_value_t w_value_clone(w_value_t *v) {
 			char *ptr = malloc(s->len);
 			memcpy(ptr, s->ptr, s->len);
 			w_string_t *new = malloc(sizeof(w_string_t));
-			*new = (w_string_t){1, s->len, ptr};
+			*new = (w_string_t){1, s->len, ptr, s->hash};
 			return (w_value_t){.type = W_VALUE_STRING, .string = new};
 		}
 		case W_VALUE_MAP: {
-			w_map_t *map = malloc(sizeof(w_map_t));
-			*map = w_map_clone(v->map, 1); // clone with refcount 1
-			return (w_value_t){.type = W_VALUE_MAP, .map = map};
+			return (w_value_t){.type = W_VALUE_MAP, .map = w_map_clone(v->map)};
 		}
 	}
 }
 
 // map impl
 
-static void map_free(w_refcount_t refcount, w_value_t *val) {
-	w_value_release(val);
+#define SHAPE_KEYS 64 // most keys a shape has. slots have to fit in w_ast_t.hits for W_QUICK_MAP_SLOT.
+#define SHAPE_CHILDREN 16 // most shapes made from a single shape
+#define SHAPES 4096 // most shapes made in total
+
+static w_shape_t empty_shape; // shape of new maps
+static size_t shapes_len;
+
+// returns the slot of key in shape, or shape->len if it doesn't have it
+static size_t shape_find(w_shape_t *shape, w_astring_t *key) {
+	for(size_t i = 0; i < shape->len; i++) {
+		w_astring_t *k = &shape->keys[i];
+		if(k->len == key->len && (key->len == 0 || memcmp(k->ptr, key->ptr, key->len) == 0))
+			return i;
+	}
+	return shape->len;
+}
+
+// returns the shape made by adding key to shape, making it if it doesn't exist yet. returns NULL if it would be one too many.
+static w_shape_t *shape_add(w_shape_t *shape, w_astring_t *key) {
+	for(w_shape_t *c = shape->children; c != NULL; c = c->next)
+		if(w_astreq(&c->keys[c->len-1], key))
+			return c;
+	if(shape->len >= SHAPE_KEYS || shape->children_len >= SHAPE_CHILDREN || shapes_len >= SHAPES)
+		return NULL;
+	w_shape_t *new = malloc(sizeof(w_shape_t));
+	w_astring_t *keys = malloc(sizeof(w_astring_t)*(shape->len+1));
+	if(shape->len != 0)
+		memcpy(keys, shape->keys, sizeof(w_astring_t)*shape->len);
+	keys[shape->len] = w_astrdup(key);
+	*new = (w_shape_t){shape->len+1, keys, NULL, 0, shape->children};
+	shape->children = new;
+	shape->children_len++;
+	shapes_len++;
+	return new;
+}
+
+// returns the slot of key in a dictionary, or SIZE_MAX if it doesn't have it
+static size_t dict_find(w_map_t *map, w_astring_t *key) {
+	if(map->index_cap == 0)
+		return SIZE_MAX;
+	size_t mask = map->index_cap-1, hash = w_hash(key);
+	for(size_t i = hash & mask; map->index[i] != 0; i = (i+1) & mask) {
+		size_t slot = map->index[i]-1;
+		// holes stay in the index until it's rebuilt, and are skipped like any other key
+		if(map->slots[slot].type != W_VALUE_UNSET && map->keys[slot].hash == hash && w_astreq(&map->keys[slot], key))
+			return slot;
+	}
+	return SIZE_MAX;
+}
+
+static void dict_index_add(w_map_t *map, size_t slot) {
+	size_t mask = map->index_cap-1, i = map->keys[slot].hash & mask;
+	while(map->index[i] != 0)
+		i = (i+1) & mask;
+	map->index[i] = slot+1;
+}
+
+// closes up the holes of a dictionary and rebuilds its index, with room for one more key. the index is kept at most 2/3 full, and
+// is rebuilt 1/3 full so that it doubles as the map grows.
+static void dict_reindex(w_map_t *map) {
+	size_t len = 0;
+	for(size_t i = 0; i < map->len; i++) {
+		if(map->slots[i].type == W_VALUE_UNSET)
+			continue;
+		map->slots[len] = map->slots[i];
+		map->keys[len++] = map->keys[i];
+	}
+	map->len = len;
+	map->holes = 0;
+	size_t cap = 8;
+	while(cap < (len+1)*3)
+		cap *= 2;
+	free(map->index);
+	map->index = calloc(cap, sizeof(uint32_t));
+	map->index_cap = cap;
+	for(size_t i = 0; i < len; i++)
+		dict_index_add(map, i);
+}
+
+// turns a map with a shape into a dictionary. the values stay in the same slots, in the same order.
+static void map_unshape(w_map_t *map) {
+	size_t len = map->shape->len;
+	map->keys = malloc(sizeof(w_astring_t)*(len+1));
+	for(size_t i = 0; i < len; i++) {
+		w_hash(&map->shape->keys[i]);
+		map->keys[i] = w_astrdup(&map->shape->keys[i]);
+	}
+	map->slots = realloc(map->slots, sizeof(w_value_t)*(len+1));
+	map->len = len;
+	map->cap = len+1;
+	map->shape = NULL;
+	dict_reindex(map);
 }
 
-static w_value_t map_clone(w_refcount_t refcount, w_value_t *val) {
+w_map_t *w_map_new(void) {
+	w_map_t *map = malloc(sizeof(w_map_t));
+	*map = (w_map_t){1, &empty_shape};
+	return map;
+}
+
+void w_map_free(w_map_t *map) {
+	if(map->shape != NULL) {
+		for(size_t i = 0; i < map->shape->len; i++)
+			w_value_release(&map->slots[i]);
+	}
+	else {
+		for(size_t i = 0; i < map->len; i++) {
+			if(map->slots[i].type == W_VALUE_UNSET)
+				continue;
+			w_value_release(&map->slots[i]);
+			free(map->keys[i].ptr);
+		}
+		free(map->keys);
+		free(map->index);
+	}
+	free(map->slots);
+	free(map);
+}
+
+w_map_t *w_map_clone(w_map_t *map) {
+	w_map_t *new = malloc(sizeof(w_map_t));
+	*new = (w_map_t){1, map->shape};
+	size_t len = map->shape == NULL ? map->len : map->shape->len;
+	if(len != 0) {
+		new->slots = malloc(sizeof(w_value_t)*len);
+		for(size_t i = 0; i < len; i++) {
+			new->slots[i] = map->slots[i];
+			w_value_ref(&new->slots[i]);
+		}
+	}
+	if(map->shape != NULL)
+		return new;
+	// the holes come along, so that the index can be copied as is
+	new->keys = malloc(sizeof(w_astring_t)*len);
+	for(size_t i = 0; i < len; i++)
+		new->keys[i] = map->slots[i].type == W_VALUE_UNSET ? (w_astring_t){0} : w_astrdup(&map->keys[i]);
+	new->len = new->cap = len;
+	new->holes = map->holes;
+	new->index = malloc(sizeof(uint32_t)*map->index_cap);
+	memcpy(new->index, map->index, sizeof(uint32_t)*map->index_cap);
+	new->index_cap = map->index_cap;
+	return new;
+}
+
+w_value_t *w_map_get(w_map_t *map, w_astring_t *key) {
+	if(map->shape == NULL) {
+		size_t i = dict_find(map, key);
+		return i == SIZE_MAX ? NULL : &map->slots[i];
+	}
+	size_t i = shape_find(map->shape, key);
+	return i < map->shape->len ? &map->slots[i] : NULL;
+}
+
+void w_map_set(w_map_t *map, w_astring_t *key, w_value_t value) {
+	w_value_t *v = w_map_get(map, key);
+	if(v != NULL) {
+		w_value_release(v);
+		*v = value;
+		return;
+	}
+	if(map->shape != NULL) {
+		w_shape_t *shape = shape_add(map->shape, key);
+		if(shape != NULL) {
+			map->slots = realloc(map->slots, sizeof(w_value_t)*shape->len);
+			map->slots[shape->len-1] = value;
+			map->shape = shape;
+			return;
+		}
+		map_unshape(map);
+	}
+	if((map->len+1)*3 > map->index_cap*2)
+		dict_reindex(map);
+	if(map->len == map->cap) {
+		map->cap = map->cap*2+8;
+		map->slots = realloc(map->slots, sizeof(w_value_t)*map->cap);
+		map->keys = realloc(map->keys, sizeof(w_astring_t)*map->cap);
+	}
+	w_hash(key);
+	map->keys[map->len] = w_astrdup(key);
+	map->slots[map->len] = value;
+	dict_index_add(map, map->len++);
+}
+
+void w_map_del(w_map_t *map, w_astring_t *key) {
+	if(map->shape != NULL) {
+		if(shape_find(map->shape, key) == map->shape->len)
+			return;
+		map_unshape(map);
+	}
+	size_t i = dict_find(map, key);
+	if(i == SIZE_MAX)
+		return;
+	w_value_release(&map->slots[i]);
+	map->slots[i] = (w_value_t){.type = W_VALUE_UNSET};
+	free(map->keys[i].ptr);
+	map->keys[i] = (w_astring_t){0};
+	if(++map->holes*2 > map->len)
+		dict_reindex(map);
+}
+
+bool w_map_next(w_map_t *map, w_map_iter_t *it, w_astring_t **key, w_value_t **value) {
+	if(map->shape != NULL) {
+		if(it->i >= map->shape->len)
+			return false;
+		*key = &map->shape->keys[it->i];
+		*value = &map->slots[it->i];
+		it->i++;
+		return true;
+	}
+	for(; it->i < map->len; it->i++) {
+		if(map->slots[it->i].type == W_VALUE_UNSET)
+			continue;
+		*key = &map->keys[it->i];
+		*value = &map->slots[it->i++];
+		return true;
+	}
+	return false;
+}
+
+// vartable impl
+
+static void vt_free(w_scope_t scope, w_value_t *val) {
+	if(val->type != W_VALUE_UNSET)
+		w_value_release(val);
+}
+
+static w_value_t vt_clone(w_scope_t scope, w_value_t *val) {
 	w_value_ref(val);
 	return *val;
 }
 
-W_HASHTABLE_C(w_map, w_value_t, w_refcount_t, map_free, map_clone);
+W_HASHTABLE_C(w_vartable, w_value_t, w_scope_t, vt_free, vt_clone);
 
-// vartable impl
+// frames with fewer slots than this are kept around for reuse once freed
+#define FRAME_POOL 16
+static w_frame_t *frame_pool[FRAME_POOL];
+
+static w_frame_t *frame_new(w_frame_t *parent, w_layout_t *layout, w_scope_t scope) {
+	size_t len = layout == NULL ? 0 : layout->len;
+	w_frame_t *f;
+	if(len < FRAME_POOL && frame_pool[len] != NULL) {
+		f = frame_pool[len];
+		frame_pool[len] = f->parent;
+	}
+	else
+		f = malloc(sizeof(w_frame_t)+sizeof(w_value_t)*len);
+	*f = (w_frame_t){parent, layout, scope, false, layout == NULL ? 0 : layout->bloom, (w_vartable_t){.data = scope}};
+	for(size_t i = 0; i < len; i++)
+		f->slots[i].type = W_VALUE_UNSET;
+	return f;
+}
 
-static void vt_free(w_scope_t scope, w_var_t *var) {
-	if(var->scope == scope) {
-		w_value_release(var->val);
-		free(var->val);
+static void frame_free(w_frame_t *f) {
+	size_t len = f->layout == NULL ? 0 : f->layout->len;
+	for(size_t i = 0; i < len; i++) {
+		if(f->slots[i].type != W_VALUE_UNSET) {
+			w_value_release(&f->slots[i]);
+			f->layout->syms[i]->version++;
+		}
+	}
+	if(f->vars.capacity != 0) {
+		size_t it = 0;
+		w_astring_t *key;
+		w_value_t *v;
+		while(w_vartable_next(&f->vars, &it, &key, &v))
+			w_ctx_changed(key);
+		w_vartable_free(&f->vars);
+	}
+	if(len < FRAME_POOL) {
+		f->parent = frame_pool[len];
+		frame_pool[len] = f;
+	}
+	else
+		free(f);
+}
+
+// returns the frame of the current scope, creating one if it doesn't have one
+static w_frame_t *own_frame(w_ctx_t *ctx) {
+	if(ctx->frame == NULL || ctx->frame->scope != ctx->scope)
+		ctx->frame = frame_new(ctx->frame, NULL, ctx->scope);
+	return ctx->frame;
+}
+
+// gets a name from a single frame, ignoring the first from slots. deleted names give a W_VALUE_UNSET value, and names the frame doesn't
+// have give NULL.
+static w_value_t *frame_get(w_frame_t *f, w_astring_t *str, size_t from) {
+	if(f->vars.capacity != 0) {
+		w_value_t *v = w_vartable_get(&f->vars, str);
+		if(v != NULL)
+			return v;
 	}
+	if(f->layout != NULL)
+		for(size_t i = f->layout->len; i > from; i--)
+			if(f->slots[i-1].type != W_VALUE_UNSET && w_astreq(&f->layout->names[i-1], str))
+				return &f->slots[i-1];
+	return NULL;
 }
 
-static w_var_t vt_clone(w_scope_t scope, w_var_t *var) {
-	return *var;
+// checks whether a name is declared in the current scope itself
+static bool declared(w_ctx_t *ctx, w_astring_t *str) {
+	w_frame_t *f = ctx->frame;
+	if(f == NULL || f->scope != ctx->scope)
+		return false;
+	w_value_t *v = frame_get(f, str, f->layout == NULL ? 0 : f->layout->argc);
+	return v != NULL && v->type != W_VALUE_UNSET;
 }
 
-W_HASHTABLE_C(w_vartable, w_var_t, w_scope_t, vt_free, vt_clone);
+// declares a variable by name in the current scope
+static void frame_let(w_ctx_t *ctx, w_astring_t *str, w_value_t val) {
+	w_frame_t *f = own_frame(ctx);
+	if(f->vars.capacity == 0)
+		f->vars = w_vartable_new(f->parent == NULL ? 64 : 4, f->scope);
+	w_vartable_set(&f->vars, str, val);
+	w_ctx_changed(str);
+	f->bloom |= w_bloom(str);
+	f->dynamic = true;
+}
 
 w_ctx_t w_empty_ctx(w_status_t *status) {
-	return (w_ctx_t){0, w_vartable_new(512, 0), status};
+	w_ctx_t ctx = (w_ctx_t){0, status, NULL, NULL};
+	own_frame(&ctx);
+	return ctx;
 }
 
 w_value_t w_make_command(w_externcmd_t fp) {
 	w_ecmd_t *ecmd = malloc(sizeof(w_ecmd_t));
-	*ecmd = (w_ecmd_t){1, fp, NULL};
+	*ecmd = (w_ecmd_t){1, fp, NULL, NULL, false};
+	return (w_value_t){.type = W_VALUE_EXTERNCMD, .externcmd = ecmd};
+}
+
+w_value_t w_make_strict_command(w_strictcmd_t fp, bool borrow) {
+	w_ecmd_t *ecmd = malloc(sizeof(w_ecmd_t));
+	*ecmd = (w_ecmd_t){1, NULL, NULL, fp, borrow};
 	return (w_value_t){.type = W_VALUE_EXTERNCMD, .externcmd = ecmd};
 }
 
 w_ctx_t w_default_ctx(w_status_t *status) {
 	w_ctx_t ctx = w_empty_ctx(status);
 	#define CMD(NAME) w_make_command(&w_cmd_##NAME)
+	#define STRICT(NAME) w_make_strict_command(&w_cmd_##NAME, false)
+	#define READER(NAME) w_make_strict_command(&w_cmd_##NAME, true)
 	w_ctx_letc(&ctx, "echo", CMD(echo));
 	w_ctx_letc(&ctx, "echoln", CMD(echoln));
-	w_ctx_letc(&ctx, "read", CMD(read));
+	w_ctx_letc(&ctx, "read", STRICT(read));
 	w_ctx_letc(&ctx, "readln", CMD(readln));
-	w_ctx_letc(&ctx, "write", CMD(write));
+	w_ctx_letc(&ctx, "write", STRICT(write));
 	
-	w_ctx_letc(&ctx, "+", CMD(add));
-	w_ctx_letc(&ctx, "-", CMD(sub));
-	w_ctx_letc(&ctx, "*", CMD(mul));
-	w_ctx_letc(&ctx, "/", CMD(div));
-	w_ctx_letc(&ctx, "%", CMD(mod));
+	w_ctx_letc(&ctx, "+", READER(add));
+	w_ctx_letc(&ctx, "-", READER(sub));
+	w_ctx_letc(&ctx, "*", READER(mul));
+	w_ctx_letc(&ctx, "/", READER(div));
+	w_ctx_letc(&ctx, "%", READER(mod));
 	
-	w_ctx_letc(&ctx, "=", CMD(equ));
-	w_ctx_letc(&ctx, "!=", CMD(neq));
-	w_ctx_letc(&ctx, "<", CMD(lt));
-	w_ctx_letc(&ctx, "<=", CMD(lte));
-	w_ctx_letc(&ctx, ">", CMD(gt));
-	w_ctx_letc(&ctx, ">=", CMD(gte));
+	w_ctx_letc(&ctx, "=", READER(equ));
+	w_ctx_letc(&ctx, "!=", READER(neq));
+	w_ctx_letc(&ctx, "<", READER(lt));
+	w_ctx_letc(&ctx, "<=", READER(lte));
+	w_ctx_letc(&ctx, ">", READER(gt));
+	w_ctx_letc(&ctx, ">=", READER(gte));
 	w_ctx_letc(&ctx, "&", CMD(and));
 	w_ctx_letc(&ctx, "|", CMD(or));
 	
-	w_ctx_letc(&ctx, "int", CMD(int));
-	w_ctx_letc(&ctx, "float", CMD(float));
-	w_ctx_letc(&ctx, "string", CMD(string));
+	w_ctx_letc(&ctx, "int", READER(int));
+	w_ctx_letc(&ctx, "float", READER(float));
+	w_ctx_letc(&ctx, "string", READER(string));
 	
 	w_ctx_letc(&ctx, "set!", CMD(set));
 	w_ctx_letc(&ctx, "let!", CMD(let));
@@ -705,52 +1124,71 @@ w_ctx_t w_default_ctx(w_status_t *status) {
 	w_ctx_letc(&ctx, "do", CMD(do));
 	w_ctx_letc(&ctx, "for", CMD(for));
 	
-	w_ctx_letc(&ctx, "list", CMD(list));
-	w_ctx_letc(&ctx, "new-list", CMD(new_list));
-	w_ctx_letc(&ctx, "range", CMD(range));
-	w_ctx_letc(&ctx, "map", CMD(map));
+	w_ctx_letc(&ctx, "list", STRICT(list));
+	w_ctx_letc(&ctx, "new-list", STRICT(new_list));
+	w_ctx_letc(&ctx, "range", STRICT(range));
+	w_ctx_letc(&ctx, "map", STRICT(map));
 	
-	w_ctx_letc(&ctx, "refcount", CMD(refcount));
+	w_ctx_letc(&ctx, "refcount", STRICT(refcount));
 	
 	w_ctx_letc(&ctx, "cmd", CMD(cmd));
+	w_ctx_letc(&ctx, "memo", STRICT(memo));
+	w_ctx_letc(&ctx, "memo-clear", STRICT(memo_clear));
 	#undef CMD
+	#undef STRICT
+	#undef READER
 	return ctx;
 }
 
 w_value_t *w_ctx_get(w_ctx_t *ctx, w_astring_t *str) {
-	w_var_t *var = w_vartable_get(&ctx->vartable, str);
-	if(var == NULL)
-		return NULL;
-	return var->val;
+	uint64_t bit = w_bloom(str);
+	for(w_frame_t *f = ctx->frame; f != NULL; f = f->parent) {
+		if(!(f->bloom & bit))
+			continue;
+		w_value_t *v = frame_get(f, str, 0);
+		if(v != NULL)
+			return v->type == W_VALUE_UNSET ? NULL : v;
+	}
+	return NULL;
 }
 
 void w_ctx_set(w_ctx_t *ctx, w_astring_t *str, w_value_t val) {
-	w_var_t *vp = w_vartable_get(&ctx->vartable, str);
+	w_value_t *vp = w_ctx_get(ctx, str);
 	if(vp == NULL) {
 		char *cstr = w_ast_cstr(str);
 		w_status_err(ctx->status, w_error_new((w_filepos_t){}, "Variable %s does not exist. (perhaps you meant to use let!)", cstr));
 		free(cstr);
 		return;
 	}
-	w_value_release(vp->val);
-	*vp->val = val;
+	w_value_release(vp);
+	*vp = val;
+	w_ctx_changed(str);
+}
+
+// error for redeclaring a variable
+static void redeclared(w_ctx_t *ctx, w_astring_t *str) {
+	char *cstr = w_ast_cstr(str);
+	w_status_err(ctx->status, w_error_new((w_filepos_t){}, "Cannot redeclare variable %s. (perhaps you meant to use set!)", cstr));
+	free(cstr);
 }
 
 void w_ctx_let(w_ctx_t *ctx, w_astring_t *str, w_value_t val) {
-	w_var_t *vp = w_vartable_get(&ctx->vartable, str);
-	if(vp != NULL && vp->scope == ctx->scope) {
-		char *cstr = w_ast_cstr(str);
-		w_status_err(ctx->status, w_error_new((w_filepos_t){}, "Cannot redeclare variable %s. (perhaps you meant to use set!)", cstr));
-		free(cstr);
+	if(declared(ctx, str)) {
+		redeclared(ctx, str);
 		return;
 	}
-	w_var_t var = (w_var_t){ctx->scope, malloc(sizeof(w_value_t))};
-	*var.val = val;
-	w_vartable_set(&ctx->vartable, str, var);
+	frame_let(ctx, str, val);
 }
 
 void w_ctx_del(w_ctx_t *ctx, w_astring_t *str) {
-	w_vartable_del(&ctx->vartable, str);
+	w_frame_t *f = own_frame(ctx);
+	w_value_t *v = frame_get(f, str, f->layout == NULL ? 0 : f->layout->argc);
+	if(v != NULL && v->type != W_VALUE_UNSET) {
+		w_value_release(v);
+		v->type = W_VALUE_UNSET;
+	}
+	// the name stays deleted, even if an enclosing scope has it
+	frame_let(ctx, str, (w_value_t){.type = W_VALUE_UNSET});
 }
 
 w_value_t *w_ctx_getc(w_ctx_t *ctx, char *cstr) {
@@ -768,26 +1206,336 @@ void w_ctx_letc(w_ctx_t *ctx, char *cstr, w_value_t val) {
 	return w_ctx_let(ctx, &str, val);
 }
 
+// gets the slot a resolved variable is stored in. returns NULL if the name has to be looked up instead.
+static w_value_t *slot_get(w_ctx_t *ctx, w_ast_slot_t *s) {
+	if(s->layout == NULL)
+		return NULL;
+	w_frame_t *f = ctx->frame;
+	for(uint32_t i = 0; i < s->depth; i++) {
+		if(f == NULL || f->dynamic)
+			return NULL;
+		f = f->parent;
+	}
+	if(f == NULL || f->dynamic || f->layout != s->layout)
+		return NULL;
+	w_value_t *v = &f->slots[s->index];
+	return v->type == W_VALUE_UNSET ? NULL : v;
+}
+
+w_value_t *w_ctx_get_var(w_ctx_t *ctx, w_ast_t *var) {
+	w_value_t *v = slot_get(ctx, &var->slot);
+	if(v != NULL)
+		return v;
+	return w_ctx_get(ctx, &var->string);
+}
+
+void w_ctx_let_var(w_ctx_t *ctx, w_ast_t *var, w_value_t val) {
+	w_ast_slot_t *s = &var->slot;
+	w_frame_t *f = ctx->frame;
+	if(s->layout == NULL || s->depth != 0 || f == NULL || f->scope != ctx->scope || f->dynamic || f->layout != s->layout) {
+		w_ctx_let(ctx, &var->string, val);
+		return;
+	}
+	// the same name can have more than one slot, if it was declared more than once
+	if(declared(ctx, &var->string)) {
+		redeclared(ctx, &var->string);
+		return;
+	}
+	f->slots[s->index] = val;
+	f->layout->syms[s->index]->version++;
+}
+
+void w_ctx_set_var(w_ctx_t *ctx, w_ast_t *var, w_value_t val) {
+	w_value_t *v = slot_get(ctx, &var->slot);
+	if(v == NULL) {
+		w_ctx_set(ctx, &var->string, val);
+		return;
+	}
+	w_value_release(v);
+	*v = val;
+	var->slot.layout->syms[var->slot.index]->version++;
+}
+
+w_value_t *w_ctx_get_cmd(w_ctx_t *ctx, w_ast_command_t *cmd) {
+	w_ic_t *ic = cmd->ic;
+	if(ic != NULL && ic->version == ic->sym->version)
+		return &ic->val;
+	w_ast_t *name = &cmd->ptr[0];
+	w_value_t *v = w_ctx_get_var(ctx, name);
+	if(v == NULL)
+		return NULL;
+	if(ic == NULL) {
+		ic = cmd->ic = malloc(sizeof(w_ic_t));
+		ic->sym = w_intern(&name->string);
+	}
+	ic->version = ic->sym->version;
+	ic->val = *v;
+	return v;
+}
+
+void w_ctx_changed(w_astring_t *str) {
+	w_intern(str)->version++;
+}
+
 w_ctx_t w_ctx_clone(w_ctx_t *ctx) {
-	w_ctx_t new = (w_ctx_t){ctx->scope+1, w_vartable_clone(&ctx->vartable, ctx->vartable.data+1), ctx->status};
+	return (w_ctx_t){ctx->scope+1, ctx->status, ctx->frame, ctx->budget};
+}
+
+w_ctx_t w_ctx_enter(w_ctx_t *ctx, w_layout_t *layout) {
+	w_ctx_t new = w_ctx_clone(ctx);
+	if(layout != NULL && layout->len > 0)
+		new.frame = frame_new(ctx->frame, layout, new.scope);
 	return new;
 }
+
 void w_ctx_free(w_ctx_t *ctx) {
-	w_vartable_free(&ctx->vartable);
+	w_frame_t *f = ctx->frame;
+	if(f != NULL && f->scope == ctx->scope)
+		frame_free(f);
+}
+
+// checks whether a name is one of the arguments of cmd
+static bool is_arg(w_cmd_t *cmd, w_astring_t *str) {
+	for(size_t i = 0; i < cmd->argc; i++)
+		if(w_astreq(&cmd->args[i].name, str))
+			return true;
+	return false;
+}
+
+bool w_ctx_droppable(w_ctx_t *ctx, w_frame_t *until, w_cmd_t *cmd) {
+	// scoping is dynamic, so the called command could see anything these frames have. variables that aren't declared yet don't count.
+	for(w_frame_t *f = ctx->frame; f != until; f = f->parent) {
+		size_t it = 0;
+		w_astring_t *key;
+		w_value_t *v;
+		while(w_vartable_next(&f->vars, &it, &key, &v))
+			if(!is_arg(cmd, key))
+				return false;
+		size_t len = f->layout == NULL ? 0 : f->layout->len;
+		for(size_t i = 0; i < len; i++)
+			if(f->slots[i].type != W_VALUE_UNSET && !is_arg(cmd, &f->layout->names[i]))
+				return false;
+	}
+	return true;
+}
+
+double w_clock(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec+t.tv_nsec/1e9;
+}
+
+w_budget_t w_budget_new(int64_t fuel, double seconds) {
+	// the first step finds the slice empty and starts one
+	return (w_budget_t){0, fuel, seconds > 0 ? w_clock()+seconds : 0, NULL, NULL};
+}
+
+bool w_budget_refill(w_ctx_t *ctx, w_filepos_t pos) {
+	w_budget_t *b = ctx->budget;
+	while(true) {
+		bool late = b->deadline != 0 && w_clock() >= b->deadline;
+		if(!late && b->fuel != 0) {
+			int64_t n = b->fuel < 0 || b->fuel > W_BUDGET_SLICE ? W_BUDGET_SLICE : b->fuel;
+			if(b->fuel > 0)
+				b->fuel -= n;
+			// the step that found the slice empty is taken from the new one
+			b->slice = n-1;
+			return true;
+		}
+		if(b->yield == NULL || !b->yield(ctx, b)) {
+			b->slice = 0;
+			w_status_err(ctx->status, w_error_new(pos, late ? "Deadline exceeded." : "Out of fuel."));
+			return false;
+		}
+	}
+}
+
+// executions with the same types before a node specializes itself
+#define QUICKEN 4
+
+void w_ast_unquicken(w_ast_t *ast) {
+	ast->quick = W_QUICK_NONE;
+	ast->hits = 0;
+	ast->cache = NULL;
+}
+
+// string literals make a new string every time, since members like string:cat! change strings in place
+w_value_t w_eval_string(w_ast_t *ast) {
+	w_astring_t *s = &ast->string;
+	w_string_t *str = malloc(sizeof(w_string_t));
+	*str = (w_string_t){1, s->len, malloc(s->len), s->hash};
+	memcpy(str->ptr, s->ptr, str->len);
+	return (w_value_t){.type = W_VALUE_STRING, .string = str};
+}
+
+w_value_t w_eval_index(w_ctx_t *ctx, w_ast_t *ast, w_value_t *left, w_value_t *right) {
+	w_ast_t *key = ast->index.right;
+	bool field = left->type == W_VALUE_MAP && key->type == W_AST_STRING;
+	if(ast->quick == W_QUICK_MAP_SLOT) {
+		if(field && left->map->shape == ast->cache) {
+			w_value_t v = left->map->slots[ast->hits];
+			w_value_ref(&v);
+			return v;
+		}
+		w_ast_unquicken(ast);
+	}
+	bool list_int = left->type == W_VALUE_LIST && right->type == W_VALUE_INT;
+	if(ast->quick == W_QUICK_LIST_INT) {
+		if(list_int && right->int_ >= 0 && right->int_ < left->list->len) {
+			w_value_t v = left->list->ptr[right->int_];
+			w_value_ref(&v);
+			return v;
+		}
+		w_ast_unquicken(ast);
+	}
+	else if(list_int && ++ast->hits >= QUICKEN)
+		ast->quick = W_QUICK_LIST_INT;
+	// literal member names were resolved by the parser
+	w_value_t ret = key->type == W_AST_STRING ? value_index(ctx, left, right, key->member) : w_value_index(ctx, left, right);
+	if(ctx->status->tag != W_STATUS_OK) {
+		ctx->status->err->pos = ast->index.left->pos;
+		return ret;
+	}
+	// fields of maps with a shape are cached with their slot, unless the key names a method
+	if(field && left->map->shape != NULL && w_value_method(W_VALUE_MAP, key->member) == NULL && ++ast->hits >= QUICKEN) {
+		ast->quick = W_QUICK_MAP_SLOT;
+		ast->cache = left->map->shape;
+		ast->hits = shape_find(left->map->shape, &key->string);
+	}
+	return ret;
+}
+
+// builtins that blocks calling them specialize for
+static struct {
+	w_strictcmd_t cmd;
+	w_quick_t quick;
+} binops[] = {
+	{&w_cmd_add, W_QUICK_ADD}, {&w_cmd_sub, W_QUICK_SUB}, {&w_cmd_mul, W_QUICK_MUL}, {&w_cmd_div, W_QUICK_DIV}, {&w_cmd_mod, W_QUICK_MOD},
+	{&w_cmd_equ, W_QUICK_EQU}, {&w_cmd_neq, W_QUICK_NEQ},
+	{&w_cmd_lt, W_QUICK_LT}, {&w_cmd_lte, W_QUICK_LTE}, {&w_cmd_gt, W_QUICK_GT}, {&w_cmd_gte, W_QUICK_GTE}
+};
+
+// counts an execution of a block towards specializing it, if it's a single call of a binop builtin that evaluates in the scope it's given
+static void quicken_block(w_ast_t *ast, bool scoped) {
+	w_ast_commands_t *cmds = &ast->commands;
+	if(cmds->len != 1 || (!scoped && cmds->layout != NULL && cmds->layout->len > 0))
+		return;
+	w_ast_command_t *cmd = &cmds->ptr[0];
+	w_ic_t *ic = cmd->ic;
+	if(cmd->len != 3 || cmd->ptr[0].type != W_AST_STRING || ic == NULL || ic->version != ic->sym->version || ic->val.type != W_VALUE_EXTERNCMD)
+		return;
+	for(size_t i = 0; i < sizeof(binops)/sizeof(binops[0]); i++) {
+		if(binops[i].cmd == ic->val.externcmd->strict) {
+			if(++ast->hits >= QUICKEN)
+				ast->quick = binops[i].quick;
+			return;
+		}
+	}
+}
+
+static w_value_t eval(w_ctx_t *ctx, w_ast_t *ast, w_ctx_t *sub_ctx, w_value_t *this);
+
+bool w_ast_inert(w_ast_t *ast) {
+	switch(ast->type) {
+		case W_AST_COMMANDS:
+		case W_AST_INDEX:
+			return false;
+		default:
+			return true;
+	}
+}
+
+bool w_eval_borrowed(w_ctx_t *ctx, w_ast_t *ast, w_value_t *this, w_value_t *out) {
+	switch(ast->type) {
+		case W_AST_VAR: {
+			if(w_astreqc(&ast->string, "this")) {
+				*out = this == NULL ? (w_value_t){.type = W_VALUE_NULL} : *this;
+				return false;
+			}
+			w_value_t *v = w_ctx_get_var(ctx, ast);
+			if(v == NULL)
+				break;
+			*out = *v;
+			return false;
+		}
+		default:
+			break;
+	}
+	*out = eval(ctx, ast, NULL, this);
+	return true;
+}
+
+// evaluates the argument of a read-only operation that's followed by next, borrowing it if next can't invalidate it. next is NULL
+// for the last argument.
+static bool eval_operand(w_ctx_t *ctx, w_ast_t *ast, w_ast_t *next, w_value_t *this, w_value_t *out) {
+	if(next == NULL || w_ast_inert(next))
+		return w_eval_borrowed(ctx, ast, this, out);
+	*out = eval(ctx, ast, NULL, this);
+	return true;
+}
+
+// runs a specialized binop block. this is the same as calling the builtin with two arguments.
+static w_value_t eval_binop(w_ctx_t *ctx, w_ast_t *ast, w_value_t *this) {
+	w_ast_command_t *cmd = &ast->commands.ptr[0];
+	w_value_t a, b;
+	bool own_a = eval_operand(ctx, &cmd->ptr[1], &cmd->ptr[2], this, &a);
+	if(ctx->status->tag != W_STATUS_OK)
+		return (w_value_t){};
+	bool own_b = eval_operand(ctx, &cmd->ptr[2], NULL, this, &b);
+	if(ctx->status->tag != W_STATUS_OK) {
+		if(own_a)
+			w_value_release(&a);
+		return (w_value_t){};
+	}
+	#define RET(V) (w_value_t){.type = W_VALUE_INT, .int_ = (V)}
+	if(a.type == W_VALUE_INT && b.type == W_VALUE_INT) {
+		int64_t x = a.int_, y = b.int_;
+		switch((w_quick_t)ast->quick) {
+			case W_QUICK_ADD: return RET(x+y);
+			case W_QUICK_SUB: return RET(x-y);
+			case W_QUICK_MUL: return RET(x*y);
+			case W_QUICK_DIV: return RET(x/y);
+			case W_QUICK_MOD: return RET(x%y);
+			case W_QUICK_EQU: return RET(x == y);
+			case W_QUICK_NEQ: return RET(x != y);
+			case W_QUICK_LT: return RET(x < y);
+			case W_QUICK_LTE: return RET(x <= y);
+			case W_QUICK_GT: return RET(x > y);
+			case W_QUICK_GTE: return RET(x >= y);
+		}
+	}
+	w_value_t ret;
+	switch((w_quick_t)ast->quick) {
+		case W_QUICK_ADD: ret = w_value_add(ctx, &a, &b); break;
+		case W_QUICK_SUB: ret = w_value_sub(ctx, &a, &b); break;
+		case W_QUICK_MUL: ret = w_value_mul(ctx, &a, &b); break;
+		case W_QUICK_DIV: ret = w_value_div(ctx, &a, &b); break;
+		case W_QUICK_MOD: ret = w_value_mod(ctx, &a, &b); break;
+		case W_QUICK_EQU: ret = RET(w_value_equal(&a, &b)); break;
+		case W_QUICK_NEQ: ret = RET(!w_value_equal(&a, &b)); break;
+		case W_QUICK_LT: ret = RET(w_value_lt(ctx, &a, &b)); break;
+		case W_QUICK_LTE: ret = RET(w_value_lte(ctx, &a, &b)); break;
+		case W_QUICK_GT: ret = RET(w_value_gt(ctx, &a, &b)); break;
+		case W_QUICK_GTE: ret = RET(w_value_gte(ctx, &a, &b)); break;
+	}
+	#undef RET
+	if(own_a)
+		w_value_release(&a);
+	if(own_b)
+		w_value_release(&b);
+	// arithmetic errors get the position of the command, like in the builtins
+	if(ast->quick <= W_QUICK_MOD && ctx->status->tag != W_STATUS_OK) {
+		ctx->status->err->pos = cmd->ptr[0].pos;
+		return (w_value_t){};
+	}
+	return ret;
 }
 
 // actual eval implementation (shared ctx replaces a call to w_ctx_sub() if present)
 static w_value_t eval(w_ctx_t *ctx, w_ast_t *ast, w_ctx_t *sub_ctx, w_value_t *this) {
 	switch(ast->type) {
-		case W_AST_STRING: {
-			w_string_t *str = malloc(sizeof(w_string_t));
-			*str = (w_string_t){1, ast->string.len, malloc(ast->string.len)};
-			memcpy(str->ptr, ast->string.ptr, str->len);
-			return (w_value_t){
-				.type = W_VALUE_STRING,
-				.string = str
-			};
-		}
+		case W_AST_STRING:
+			return w_eval_string(ast);
 		case W_AST_INT:
 			return (w_value_t){
 				.type = W_VALUE_INT,
@@ -800,6 +1548,8 @@ static w_value_t eval(w_ctx_t *ctx, w_ast_t *ast, w_ctx_t *sub_ctx, w_value_t *t
 			};
 		case W_AST_NULL:
 			return (w_value_t){.type = W_VALUE_NULL};
+		case W_AST_CONST:
+			return w_value_clone(ast->value);
 		case W_AST_VAR: {
 			if(w_astreqc(&ast->string, "this")) {
 				if(this == NULL)
@@ -807,7 +1557,7 @@ static w_value_t eval(w_ctx_t *ctx, w_ast_t *ast, w_ctx_t *sub_ctx, w_value_t *t
 				w_value_ref(this);
 				return *this;
 			}
-			w_value_t *v = w_ctx_get(ctx, &ast->string);
+			w_value_t *v = w_ctx_get_var(ctx, ast);
 			if(v == NULL) {
 				char *name = w_ast_cstr(&ast->string);
 				w_status_err(ctx->status, w_error_new(ast->pos, "Unbound string %s.", name));
@@ -818,10 +1568,20 @@ static w_value_t eval(w_ctx_t *ctx, w_ast_t *ast, w_ctx_t *sub_ctx, w_value_t *t
 			return *v;
 		}
 		case W_AST_COMMANDS: {
+			if(ast->quick != W_QUICK_NONE) {
+				w_ic_t *ic = ast->commands.ptr[0].ic;
+				if(ic->version == ic->sym->version)
+					return eval_binop(sub_ctx != NULL ? sub_ctx : ctx, ast, this);
+				w_ast_unquicken(ast);
+			}
+			else if(ast->hits < QUICKEN)
+				quicken_block(ast, sub_ctx != NULL);
+			if(w_options.vm)
+				return w_vm_exec(ctx, ast, sub_ctx, this, NULL);
 			w_ctx_t _sub; // uninitialized if not used
 			w_ctx_t *sub;
 			if(sub_ctx == NULL) {
-				_sub = w_ctx_clone(ctx);
+				_sub = w_ctx_enter(ctx, ast->commands.layout);
 				sub = &_sub;
 			} else
 				sub = sub_ctx;
@@ -829,9 +1589,15 @@ static w_value_t eval(w_ctx_t *ctx, w_ast_t *ast, w_ctx_t *sub_ctx, w_value_t *t
 				w_ast_command_t *cmd = &ast->commands.ptr[i];
 				w_ast_t *name = &cmd->ptr[0];
 				w_value_t vcmd;
+				w_strictcmd_t method = NULL; // set if vcmd is the receiver of a method
+				if(!w_step(sub, name->pos)) {
+					if(sub_ctx == NULL)
+						w_ctx_free(sub);
+					return (w_value_t){};
+				}
 				// get a command from the name AST
 				if(name->type == W_AST_STRING) {
-					w_value_t *v = w_ctx_get(sub, &name->string);
+					w_value_t *v = w_ctx_get_cmd(sub, cmd);
 					if(v == NULL) {
 						char *c = w_ast_cstr(&name->string);
 						w_status_err(ctx->status, w_error_new(name->pos, "Unbound string %s.", c));
@@ -847,16 +1613,32 @@ static w_value_t eval(w_ctx_t *ctx, w_ast_t *ast, w_ctx_t *sub_ctx, w_value_t *t
 							w_ctx_free(sub);
 						return (w_value_t){};
 					}
-					w_value_ref(v);
+					// external commands aren't referenced, since nothing uses them after the call
+					if(v->type == W_VALUE_COMMAND)
+						w_value_ref(v);
 					vcmd = *v;
 				} else {
-					w_value_t v = eval(sub, name, NULL, this);
+					w_value_t v;
+					if(name->type == W_AST_INDEX && name->index.right->type == W_AST_STRING) {
+						// methods are called on the receiver directly, instead of being bound to it first
+						v = eval(sub, name->index.left, NULL, this);
+						if(sub->status->tag == W_STATUS_OK && (method = w_value_method(v.type, name->index.right->member)) == NULL) {
+							w_value_t left = v, right = w_eval_string(name->index.right);
+							v = w_eval_index(sub, name, &left, &right);
+							w_value_release(&left);
+							w_value_release(&right);
+						}
+					}
+					else
+						v = eval(sub, name, NULL, this);
 					if(sub->status->tag != W_STATUS_OK) {
 						if(sub_ctx == NULL)
 							w_ctx_free(sub);
 						return (w_value_t){};
 					}
-					switch(v.type) {
+					if(method != NULL)
+						vcmd = v;
+					else switch(v.type) {
 						case W_VALUE_EXTERNCMD:
 						case W_VALUE_COMMAND:
 							vcmd = v;
@@ -873,56 +1655,54 @@ static w_value_t eval(w_ctx_t *ctx, w_ast_t *ast, w_ctx_t *sub_ctx, w_value_t *t
 				w_args_t args = (w_args_t){cmd->len-1, cmd->ptr+1};
 				// call command
 				w_value_t ret;
+				#define RELEASE_CMD \
+					if(vcmd.type == W_VALUE_COMMAND || name->type != W_AST_STRING) \
+						w_value_release(&vcmd);
 				#define FREE \
 					if(sub_ctx == NULL) \
 						w_ctx_free(sub); \
-					w_value_release(&vcmd);
+					RELEASE_CMD;
 				switch(vcmd.type) {
 					case W_VALUE_EXTERNCMD: {
-						w_ecmd_t *ecmd = vcmd.externcmd;
-						ret = ecmd->cmd(name->pos, sub, this, ecmd->obj, args);
+						ret = w_ecmd_call(sub, vcmd.externcmd, name, args, this);
 						if(sub->status->tag != W_STATUS_OK) {
 							FREE;
 							return (w_value_t){};
 						}
 						break;
 					}
+					default:
+						ret = w_method_call(sub, method, &vcmd, name, args, this);
+						if(sub->status->tag != W_STATUS_OK) {
+							FREE;
+							return (w_value_t){};
+						}
+						break;
 					case W_VALUE_COMMAND: {
 						w_cmd_t *cmd = vcmd.cmd;
-						w_ctx_t cmdctx = w_ctx_clone(sub);
-						for(size_t i = 0; i < cmd->argc; i++) {
-							if(i >= args.len) {
-								w_ctx_let(&cmdctx, &cmd->args[i].name, (w_value_t){.type = W_VALUE_NULL});
-								continue;
-							}
-							w_value_t val = eval(sub, &args.ptr[i], NULL, this);
+						// arguments past the command's own aren't evaluated
+						size_t argc = cmd->argc < args.len ? cmd->argc : args.len;
+						w_value_t argv[argc > 0 ? argc : 1];
+						for(size_t i = 0; i < argc; i++) {
+							argv[i] = eval(sub, &args.ptr[i], NULL, this);
 							if(sub->status->tag != W_STATUS_OK) {
+								for(size_t j = 0; j < i; j++)
+									w_value_release(&argv[j]);
 								FREE;
-								w_ctx_free(&cmdctx);
 								return (w_value_t){};
 							}
-							w_ctx_let(&cmdctx, &cmd->args[i].name, val);
 						}
-						ret = eval(&cmdctx, &cmd->impl, NULL, cmd->this != NULL ? cmd->this : this);
-						w_ctx_free(&cmdctx);
-						switch(sub->status->tag) {
-							case W_STATUS_OK:
-								break;
-							case W_STATUS_RETURN:;
-								w_value_t ret = *sub->status->ret;
-								w_value_ref(&ret);
-								w_status_ok(sub->status);
-								w_value_release(&vcmd);
-								return ret;
-							default:
-								FREE;
-								return (w_value_t){};
+						ret = w_cmd_call(sub, cmd, argc, argv, this);
+						if(sub->status->tag != W_STATUS_OK) {
+							FREE;
+							return (w_value_t){};
 						}
 						break;
 					}
 				}
 				#undef FREE
-				w_value_release(&vcmd);
+				RELEASE_CMD;
+				#undef RELEASE_CMD
 				if(i+1 == ast->commands.len) {
 					if(sub_ctx == NULL)
 						w_ctx_free(sub);
@@ -934,26 +1714,203 @@ static w_value_t eval(w_ctx_t *ctx, w_ast_t *ast, w_ctx_t *sub_ctx, w_value_t *t
 		}
 		case W_AST_INDEX: {
 			w_ast_index_t idx = ast->index;
-			w_value_t left = eval(ctx, idx.left, NULL, this);
+			w_value_t left, right;
+			bool own_left = eval_operand(ctx, idx.left, idx.right, this, &left);
 			if(ctx->status->tag != W_STATUS_OK)
 				return (w_value_t){};
-			w_value_t right = eval(ctx, idx.right, NULL, this);
+			bool own_right = eval_operand(ctx, idx.right, NULL, this, &right);
 			if(ctx->status->tag != W_STATUS_OK) {
-				w_value_release(&left);
-				return (w_value_t){};
-			}
-			w_value_t ret = w_value_index(ctx, &left, &right);
-			w_value_release(&left);
-			w_value_release(&right);
-			if(ctx->status->tag != W_STATUS_OK) {
-				ctx->status->err->pos = idx.left->pos;
+				if(own_left)
+					w_value_release(&left);
 				return (w_value_t){};
 			}
+			w_value_t ret = w_eval_index(ctx, ast, &left, &right);
+			if(own_left)
+				w_value_release(&left);
+			if(own_right)
+				w_value_release(&right);
 			return ret;
 		}
 	}
 }
 
+w_value_t w_ecmd_call(w_ctx_t *ctx, w_ecmd_t *ecmd, w_ast_t *name, w_args_t args, w_value_t *this) {
+	if(ecmd->strict == NULL)
+		return ecmd->cmd(name->pos, ctx, this, ecmd->obj, args);
+	if(!ecmd->borrow)
+		return w_method_call(ctx, ecmd->strict, ecmd->obj, name, args, this);
+	w_value_t argv[args.len > 0 ? args.len : 1];
+	bool owned[args.len > 0 ? args.len : 1];
+	for(size_t i = 0; i < args.len; i++) {
+		owned[i] = eval_operand(ctx, &args.ptr[i], i+1 < args.len ? &args.ptr[i+1] : NULL, this, &argv[i]);
+		if(ctx->status->tag != W_STATUS_OK) {
+			for(size_t j = 0; j < i; j++)
+				if(owned[j])
+					w_value_release(&argv[j]);
+			return (w_value_t){};
+		}
+	}
+	w_value_t ret = w_method_invoke(ctx, ecmd->strict, ecmd->obj, name, args.len, argv, args.ptr);
+	for(size_t i = 0; i < args.len; i++)
+		if(owned[i])
+			w_value_release(&argv[i]);
+	return ret;
+}
+
+w_value_t w_method_call(w_ctx_t *ctx, w_strictcmd_t method, w_value_t *obj, w_ast_t *name, w_args_t args, w_value_t *this) {
+	w_value_t argv[args.len > 0 ? args.len : 1];
+	for(size_t i = 0; i < args.len; i++) {
+		argv[i] = eval(ctx, &args.ptr[i], NULL, this);
+		if(ctx->status->tag != W_STATUS_OK) {
+			for(size_t j = 0; j < i; j++)
+				w_value_release(&argv[j]);
+			return (w_value_t){};
+		}
+	}
+	w_value_t ret = w_method_invoke(ctx, method, obj, name, args.len, argv, args.ptr);
+	for(size_t i = 0; i < args.len; i++)
+		w_value_release(&argv[i]);
+	return ret;
+}
+
+// moves obj out of the variable var if the variable and obj are its only references. returns the emptied variable, or NULL if
+// nothing was moved.
+static w_value_t *move_last(w_ctx_t *ctx, w_ast_t *var, w_value_t *obj) {
+	w_value_t *v = w_ctx_get_var(ctx, var);
+	if(v == NULL || v->type != obj->type)
+		return NULL;
+	switch(v->type) {
+		case W_VALUE_STRING:
+			if(v->string != obj->string || v->string->refcount != 2)
+				return NULL;
+			v->string->refcount--;
+			break;
+		case W_VALUE_LIST:
+			if(v->list != obj->list || v->list->refcount != 2)
+				return NULL;
+			v->list->refcount--;
+			break;
+		case W_VALUE_MAP:
+			if(v->map != obj->map || v->map->refcount != 2)
+				return NULL;
+			v->map->refcount--;
+			break;
+		default:
+			return NULL;
+	}
+	*v = (w_value_t){.type = W_VALUE_NULL};
+	return v;
+}
+
+w_value_t w_ecmd_invoke(w_ctx_t *ctx, w_ecmd_t *ecmd, w_ast_t *name, size_t argc, w_value_t *argv, w_ast_t *asts) {
+	return w_method_invoke(ctx, ecmd->strict, ecmd->obj, name, argc, argv, asts);
+}
+
+w_value_t w_method_invoke(w_ctx_t *ctx, w_strictcmd_t method, w_value_t *obj, w_ast_t *name, size_t argc, w_value_t *argv, w_ast_t *asts) {
+	// the arguments have been evaluated by now, so if the variable still refers to the object nothing can see it change before set!
+	// overwrites it
+	w_value_t *var = NULL;
+	if(name->type == W_AST_INDEX && name->index.left->last)
+		var = move_last(ctx, name->index.left, obj);
+	w_value_t ret = method(name->pos, ctx, obj, argc, argv, asts);
+	// the object is only changed if the call succeeds, so it can be given back as it was
+	if(var != NULL && ctx->status->tag != W_STATUS_OK) {
+		*var = *obj;
+		w_value_ref(var);
+	}
+	return ret;
+}
+
+// runs the body of an internal command, which may leave a tail call
+static w_value_t eval_body(w_ctx_t *ctx, w_cmd_t *cmd, w_ctx_t *sub_ctx, w_value_t *this, w_tail_t *tail) {
+	// a body can also be a single expression, like a literal left by the optimizer
+	if(w_options.vm && cmd->impl->type == W_AST_COMMANDS)
+		return w_vm_exec(ctx, cmd->impl, sub_ctx, this, tail);
+	return eval(ctx, cmd->impl, sub_ctx, this);
+}
+
+// parses a body left for its first call, which resolves it like the resolver would have
+static bool parse_body(w_ctx_t *ctx, w_cmd_t *cmd) {
+	w_ast_t *argv = malloc(sizeof(w_ast_t)*cmd->argc);
+	for(size_t i = 0; i < cmd->argc; i++)
+		argv[i] = (w_ast_t){.type = W_AST_VAR, .string = cmd->args[i].name};
+	bool ok = w_ast_force(ctx->status, cmd->impl, cmd->argc, argv);
+	free(argv);
+	return ok;
+}
+
+w_value_t w_cmd_call(w_ctx_t *ctx, w_cmd_t *cmd, size_t argc, w_value_t *argv, w_value_t *this) {
+	w_value_t ret;
+	w_tail_t tail;
+	w_cmd_t *owned = NULL; // command of the last tail call, which is kept alive until its body is done
+	w_cmd_t *this_owner = NULL; // tail called command whose $this box this points at, kept alive as long as bodies inherit it
+	// tail calls loop here instead of nesting, reusing this call's place on the C stack
+	while(true) {
+		w_value_t *new_this = cmd->this != NULL ? cmd->this : this;
+		tail.frame = ctx->frame;
+		tail.cmd = NULL;
+		bool lazy = cmd->impl->type == W_AST_COMMANDS && cmd->impl->commands.source != NULL;
+		if(!w_step(ctx, cmd->impl->pos) || (lazy && !parse_body(ctx, cmd))) {
+			for(size_t i = 0; i < argc; i++)
+				w_value_release(&argv[i]);
+			ret = (w_value_t){};
+		}
+		else if(cmd->slots) {
+			// arguments go directly into the body's frame. the layout marks them as arguments, so the body can still redeclare them like it could
+			// when they were in a scope of their own.
+			w_ctx_t cmdctx = w_ctx_enter(ctx, cmd->impl->commands.layout);
+			w_sym_t **syms = cmd->impl->commands.layout->syms;
+			for(size_t i = 0; i < cmd->argc; i++) {
+				cmdctx.frame->slots[i] = i < argc ? argv[i] : (w_value_t){.type = W_VALUE_NULL};
+				syms[i]->version++;
+			}
+			for(size_t i = cmd->argc; i < argc; i++)
+				w_value_release(&argv[i]);
+			ret = eval_body(&cmdctx, cmd, &cmdctx, new_this, &tail);
+			w_ctx_free(&cmdctx);
+		}
+		else {
+			w_ctx_t cmdctx = w_ctx_clone(ctx);
+			for(size_t i = 0; i < cmd->argc; i++)
+				w_ctx_let(&cmdctx, &cmd->args[i].name, i < argc ? argv[i] : (w_value_t){.type = W_VALUE_NULL});
+			for(size_t i = cmd->argc; i < argc; i++)
+				w_value_release(&argv[i]);
+			ret = eval_body(&cmdctx, cmd, NULL, new_this, &tail);
+			w_ctx_free(&cmdctx);
+		}
+		// releasing a command frees its $this, which the next body gets if it doesn't have one of its own
+		w_value_t done = (w_value_t){.type = W_VALUE_COMMAND, .cmd = owned};
+		if(cmd->this != NULL && owned != NULL) {
+			done.cmd = this_owner;
+			this_owner = owned;
+		}
+		if(done.cmd != NULL)
+			w_value_release(&done);
+		owned = NULL;
+		if(tail.cmd == NULL)
+			break;
+		cmd = owned = tail.cmd;
+		argc = tail.argc;
+		argv = tail.argv;
+		this = new_this;
+	}
+	if(this_owner != NULL) {
+		w_value_t v = (w_value_t){.type = W_VALUE_COMMAND, .cmd = this_owner};
+		w_value_release(&v);
+	}
+	switch(ctx->status->tag) {
+		case W_STATUS_OK:
+			return ret;
+		case W_STATUS_RETURN:
+			// the value is moved out, so the status doesn't need to be freed
+			ret = *w_status_ret(ctx->status);
+			ctx->status->tag = W_STATUS_OK;
+			return ret;
+		default:
+			return (w_value_t){};
+	}
+}
+
 w_value_t w_eval(w_ctx_t *ctx, w_ast_t *ast) {
 	return eval(ctx, ast, NULL, NULL);
 }
@@ -11,7 +11,6 @@
 
 #include "hashtable.h"
 
-typedef uint32_t w_refcount_t;
 typedef uint32_t w_scope_t;
 
 /// Type of a value
@@ -25,7 +24,9 @@ typedef enum w_value_type {
 	W_VALUE_COMMAND, // internal command
 	W_VALUE_STRING,
 	W_VALUE_LIST,
-	W_VALUE_MAP
+	W_VALUE_MAP,
+	// internal
+	W_VALUE_UNSET // marks a variable slot that hasn't been declared. Never seen by programs.
 } w_value_type_t;
 
 typedef struct w_value w_value_t;
@@ -35,6 +36,7 @@ typedef struct w_string {
 	w_refcount_t refcount; /// Reference count
 	size_t len; /// Length of the string
 	char *ptr; /// String data
+	size_t hash; /// w_hash of the string, 0 until w_string_key computes it. Anything that changes the string resets it.
 } w_string_t;
 
 /// Represents a list
@@ -73,14 +75,24 @@ typedef struct w_value {
 
 typedef w_value_t (*w_externcmd_t)(w_filepos_t, w_ctx_t *, w_value_t *, w_value_t *, w_args_t); // unfortunately I can't typedef this earlier, since it's used in w_value_t.
 
+typedef w_value_t (*w_strictcmd_t)(w_filepos_t, w_ctx_t *, w_value_t *, size_t, w_value_t *, w_ast_t *);
+
 // simple macro to make my life easier
 #define W_COMMAND(NAME) w_value_t NAME(w_filepos_t pos, w_ctx_t *ctx, w_value_t *this, w_value_t *obj, w_args_t args)
 
+/// Declares a strict external command, which is given its arguments already evaluated instead of as ASTs. argv belongs to the caller,
+/// who releases the arguments after the call, so a command that keeps an argument has to reference it or take it over by leaving null
+/// in its place. asts are the ASTs the arguments were evaluated from, for error positions, or NULL if they weren't evaluated from any.
+#define W_STRICT(NAME) w_value_t NAME(w_filepos_t pos, w_ctx_t *ctx, w_value_t *obj, size_t argc, w_value_t *argv, w_ast_t *asts)
+
 /// An external command
 struct w_ecmd {
 	w_refcount_t refcount;
-	w_externcmd_t cmd;
+	w_externcmd_t cmd; // NULL for strict commands
 	w_value_t *obj; // an object being acted upon - if you have something like $l:my-command, this will be $l (this is used by the list functions, for example)
+	w_strictcmd_t strict; // set instead of cmd for strict commands
+	bool borrow; // whether a strict command only reads its arguments during the call. its arguments can then be borrowed from variables instead of referenced.
+	void (*drop)(w_value_t *obj); // frees obj in place of releasing it, for commands that keep state of their own around it (like the ones memo makes). NULL otherwise.
 };
 
 /// A command argument
@@ -93,28 +105,168 @@ struct w_cmd {
 	w_refcount_t refcount; /// Reference count
 	size_t argc; /// Number of arguments
 	w_cmd_arg_t *args; /// Arguments
-	w_ast_t impl; /// Implementation
+	w_ast_t *impl; /// Implementation
+	w_tree_t *tree; /// Tree impl is part of, which the command holds a reference to. NULL if impl is never freed.
 	w_value_t *this; /// $this pointer
+	bool slots; /// Whether the arguments are the first slots of impl's layout (set by the resolver for literal cmd calls)
+};
+
+/// vartable. Holds the variables a frame has by name instead of in slots; deleted names are kept as W_VALUE_UNSET so that they hide
+/// variables of enclosing scopes.
+W_HASHTABLE_H(w_vartable, w_value_t, w_scope_t);
+
+typedef struct w_shape w_shape_t;
+
+/// Keys of maps that are used like objects. Maps that were given the same keys in the same order share a shape, and keep the value of
+/// each key in the slot at its index. Shapes are never freed.
+struct w_shape {
+	size_t len; /// Number of keys
+	w_astring_t *keys; /// Keys in the order they were added. All but the last are shared with the shape this one was made from.
+	w_shape_t *children; /// Shapes made by adding a key to this one
+	size_t children_len; /// Number of children
+	w_shape_t *next; /// Next child of the shape this one was made from
 };
 
-/// A var in the var table
-typedef struct w_var {
-	w_scope_t scope;
-	w_value_t *val;
-} w_var_t;
+/// Represents a map. Maps start out with a shape, and turn into dictionaries for good once they lose a key, get too many keys or
+/// get them in an order too few other maps do. Either way, the values are kept in the order their keys were added.
+struct w_map {
+	w_refcount_t refcount; /// Reference count
+	w_shape_t *shape; /// Shape of the map, NULL once it's a dictionary
+	w_value_t *slots; /// Value of each key. A key deleted from a dictionary leaves a W_VALUE_UNSET hole, until the holes are closed up.
+	// dictionary
+	w_astring_t *keys; /// Key of each slot
+	size_t len; /// Number of slots, holes included
+	size_t cap; /// Number of slots allocated
+	size_t holes; /// Number of holes
+	uint32_t *index; /// Open addressing table of the slot of each key plus 1, or 0 for empty entries. Holes are kept until it's rebuilt.
+	size_t index_cap; /// Number of entries of index, a power of 2
+};
+
+/// Position of an iteration over a map (see w_map_next). Starts out zeroed.
+typedef struct w_map_iter {
+	size_t i; /// Slot of the next entry
+} w_map_iter_t;
+
+w_map_t *w_map_new(void); /// Creates an empty map with a refcount of 1
+void w_map_free(w_map_t *map); /// Releases the values of a map and frees it
+w_map_t *w_map_clone(w_map_t *map); /// Creates a map with references to the entries of map, and a refcount of 1
+w_value_t *w_map_get(w_map_t *map, w_astring_t *key); /// Gets the value of a key, or NULL if the map doesn't have it
+void w_map_set(w_map_t *map, w_astring_t *key, w_value_t value); /// Sets a key to value, which is taken over, releasing its old value
+void w_map_del(w_map_t *map, w_astring_t *key); /// Deletes a key, if the map has it
+/// Moves on to the next entry of a map, pointing key and value at it. Returns false once there are none left.
+bool w_map_next(w_map_t *map, w_map_iter_t *it, w_astring_t **key, w_value_t **value);
+
+typedef struct w_frame w_frame_t;
+
+/// Variables of a scope. Frames are linked to the frame of the enclosing scope instead of copying it, and scopes that don't declare
+/// anything share their parent's frame.
+struct w_frame {
+	w_frame_t *parent; /// Frame of the enclosing scope. Also used to link unused frames.
+	w_layout_t *layout; /// Layout of the block this frame is for, NULL if it only has variables by name
+	w_scope_t scope; /// Scope this frame belongs to
+	bool dynamic; /// Set once a variable is declared or deleted by name in this frame. Resolved accesses through this frame then look up names instead.
+	uint64_t bloom; /// Bloom filter of every name in the frame, to skip frames quickly when looking up names
+	w_vartable_t vars; /// Variables declared by name. capacity is 0 until the first one.
+	w_value_t slots[]; /// Slot values, W_VALUE_UNSET if not declared (yet)
+};
+
+/// Inline cache for the command name of a command
+struct w_ic {
+	w_sym_t *sym; /// Interned command name
+	uint64_t version; /// Version of the name's bindings that val is valid for
+	w_value_t val; /// Cached value. It isn't referenced, since anything that could free it also changes the version.
+};
 
-/// vartable
-W_HASHTABLE_H(w_vartable, w_var_t, w_scope_t);
-/// Represents a map
-W_HASHTABLE_H(w_map, w_value_t, w_refcount_t);
+/// Specialized forms that AST nodes rewrite themselves to after running a few times with the same types. Each one checks its guard
+/// and goes back to the generic form when it fails.
+typedef enum w_quick {
+	W_QUICK_NONE,
+	W_QUICK_LIST_INT, /// Index of a list by an int
+	W_QUICK_MAP_SLOT, /// Index of a map by a literal key. cache is the shape of the maps it's seen, and hits is the key's slot in it.
+	// blocks that are a single call of an arithmetic or comparison builtin with two arguments. the arguments are evaluated and the
+	// operation is done directly, as long as the command's name still refers to the builtin.
+	W_QUICK_ADD, W_QUICK_SUB, W_QUICK_MUL, W_QUICK_DIV, W_QUICK_MOD,
+	W_QUICK_EQU, W_QUICK_NEQ, W_QUICK_LT, W_QUICK_LTE, W_QUICK_GT, W_QUICK_GTE
+} w_quick_t;
+
+/// Builtin members of strings, lists and maps. Literal member names are resolved to these by the parser (see w_ast_t.member).
+typedef enum w_member {
+	W_MEMBER_NONE, /// Not a builtin member
+	W_MEMBER_LEN,
+	W_MEMBER_SET_MUT, W_MEMBER_SET,
+	W_MEMBER_SLICE_MUT, W_MEMBER_SLICE,
+	W_MEMBER_DUP_MUT, W_MEMBER_DUP,
+	W_MEMBER_SPLIT,
+	W_MEMBER_REVERSE_MUT, W_MEMBER_REVERSE,
+	W_MEMBER_CAT_MUT, W_MEMBER_CAT,
+	W_MEMBER_CLONE,
+	W_MEMBER_PUSH_MUT, W_MEMBER_PUSH,
+	W_MEMBER_UNSHIFT_MUT, W_MEMBER_UNSHIFT,
+	W_MEMBER_POP_MUT, W_MEMBER_POP,
+	W_MEMBER_SHIFT_MUT, W_MEMBER_SHIFT,
+	W_MEMBER_FILL_MUT, W_MEMBER_FILL,
+	W_MEMBER_DEL_MUT, W_MEMBER_DEL,
+	W_MEMBERS /// Number of members
+} w_member_t;
+
+// most arguments a tail call can pass. calls with more arguments are made normally.
+#define W_TAIL_ARGS 8
+
+/// A tail call left by a command body, for w_cmd_call to make in place of nesting it
+typedef struct w_tail {
+	w_frame_t *frame; /// Frame of the context the body was called from. The frames below it are dropped before the call.
+	w_cmd_t *cmd; /// Command to call (referenced), or NULL if the body returned normally
+	size_t argc; /// Number of arguments
+	w_value_t argv[W_TAIL_ARGS]; /// Evaluated arguments
+} w_tail_t;
+
+/// Interpreter options
+typedef struct w_options {
+	bool vm; /// Whether command blocks are compiled to bytecode and ran on the VM. When false, the AST is walked directly.
+	bool jit; /// Whether hot chunks are compiled to native code. Only does anything on x86-64 Linux.
+	size_t jit_hot; /// Number of entries and loop iterations after which a chunk is hot
+	bool fold; /// Whether programs are optimized with w_optimize before they're ran
+	bool lazy; /// Whether the parser only checks the bodies of literal cmd calls for balanced brackets, parsing them on their first call
+} w_options_t;
+
+extern w_options_t w_options; /// Global interpreter options
+
+/// The value returned by a status with the W_STATUS_RETURN tag
+#define w_status_ret(s) ((w_value_t *)(s)->ret)
+
+typedef struct w_budget w_budget_t;
 
 /// An interpreting context
 struct w_ctx {
 	w_scope_t scope; /// Current scope
-	w_vartable_t vartable; // the vartable
 	w_status_t *status; /// Interpreter status
+	w_frame_t *frame; /// Innermost frame. This belongs to an enclosing scope if the current one hasn't declared anything.
+	w_budget_t *budget; /// Limits on how long the script can run, shared with every context made from this one. NULL for no limits.
+};
+
+// number of steps between checks of a budget's deadline and fuel
+#define W_BUDGET_SLICE 1024
+
+/// Limits on how long a script runs. Every command in a block, call of an internal command and loop iteration is a step, which takes
+/// one unit of the current slice. The fuel left and the deadline are only checked when a slice runs out, so in between a step is a
+/// decrement. Steps are counted where the interpreter runs code, so the same script can take a different number of them in each mode.
+struct w_budget {
+	int64_t slice; /// Steps left in the current slice. Negative once a step has been taken without one.
+	int64_t fuel; /// Steps left after the current slice, or -1 for no limit
+	double deadline; /// Time (see w_clock) at which the script stops, or 0 for none
+	/// Called when fuel runs out or the deadline passes, with the script paused where it is. It can give the budget more fuel or move its
+	/// deadline and return true to resume the script, in which case it's called again if there still isn't any budget. Returning false
+	/// stops the script with an error, as does having no yield.
+	bool (*yield)(w_ctx_t *ctx, w_budget_t *budget);
+	void *data; /// For use by yield
 };
 
+double w_clock(void); /// Seconds on a monotonic clock
+w_budget_t w_budget_new(int64_t fuel, double seconds); /// Creates a budget with the given fuel (-1 for no limit) and a deadline the given number of seconds from now (0 for none)
+bool w_budget_refill(w_ctx_t *ctx, w_filepos_t pos); /// Starts a new slice of ctx's budget after a step found the current one empty. If there's no budget left, returns false with an error at pos in the status.
+/// Takes a step from ctx's budget, if it has one. Evaluates to false with an error at POS in the status if the script has to stop.
+#define w_step(CTX, POS) ((CTX)->budget == NULL || --(CTX)->budget->slice >= 0 || w_budget_refill(CTX, POS))
+
 char *w_typename(w_value_type_t t); /// Returns a string representing the name of a type.
 
 void w_value_release(w_value_t *val); /// Releases a value, decrementing its refcount and freeing if it's 0
@@ -122,8 +274,11 @@ void w_value_ref(w_value_t *val); /// Increases a value's refcount
 void w_value_print(w_value_t *val, FILE *fp); /// Prints a value to a given file
 bool w_value_truthy(w_value_t *v); /// Whether a value is truthy
 w_value_t w_value_index(w_ctx_t *ctx, w_value_t *left, w_value_t *right); /// Indexes a value. NOTE: does not give a file position.
+w_member_t w_member_find(w_astring_t *name); /// Finds the builtin member a name refers to, or W_MEMBER_NONE
+w_strictcmd_t w_value_method(w_value_type_t type, w_member_t member); /// Finds the builtin method member of values of a type, which indexing such a value with the member's name binds to it. Returns NULL if there is none.
 char *w_cstring(w_string_t *str); /// Converts a string to a C string
 bool w_streqc(w_string_t *a, char *b); /// Compares a w_string_t to a C string
+w_astring_t w_string_key(w_string_t *str); /// Views a string as an AST string to look it up with, caching its hash
 w_value_t w_value_clone(w_value_t *val); /// Performs a shallow clone of a value
 
 // operations
@@ -136,7 +291,9 @@ w_value_t w_value_mod(w_ctx_t *ctx, w_value_t *a, w_value_t *b);
 
 // boolean operations
 // these also do not give file positions
-bool w_value_equal(w_value_t *a, w_value_t *b); /// Compares two values
+bool w_value_equal(w_value_t *a, w_value_t *b); /// Compares two values. Lists and maps are equal if their contents are.
+bool w_value_same(w_value_t *a, w_value_t *b); /// Same as w_value_equal, except numbers have to be exactly equal instead of to within epsilon
+uint64_t w_value_hash(w_value_t *v); /// Hashes a value by its contents. Values that w_value_same finds the same hash the same.
 bool w_value_lt(w_ctx_t *ctx, w_value_t *a, w_value_t *b);
 bool w_value_lte(w_ctx_t *ctx, w_value_t *a, w_value_t *b);
 bool w_value_gt(w_ctx_t *ctx, w_value_t *a, w_value_t *b);
@@ -158,9 +315,30 @@ void w_ctx_del(w_ctx_t *ctx, w_astring_t *str); /// Deletes a variable
 w_value_t *w_ctx_getc(w_ctx_t *ctx, char *cstr); /// Same as w_ctx_set, except using a cstring
 void w_ctx_setc(w_ctx_t *ctx, char *cstr, w_value_t val); /// Same as w_ctx_get, except using a cstring.
 void w_ctx_letc(w_ctx_t *ctx, char *cstr, w_value_t val); /// Same as w_ctx_let, except using a cstring.
-w_ctx_t w_ctx_clone(w_ctx_t *ctx); /// Clones a context, incrementing the scope.
+w_value_t *w_ctx_get_var(w_ctx_t *ctx, w_ast_t *var); /// Gets a variable from a var or command name AST, using its resolved slot if possible.
+void w_ctx_let_var(w_ctx_t *ctx, w_ast_t *var, w_value_t val); /// Declares a variable from a var AST
+void w_ctx_set_var(w_ctx_t *ctx, w_ast_t *var, w_value_t val); /// Sets a variable from a var AST
+w_value_t *w_ctx_get_cmd(w_ctx_t *ctx, w_ast_command_t *cmd); /// Gets the value of a command's name (which must be a string), using the command's inline cache.
+void w_ctx_changed(w_astring_t *str); /// Invalidates cached lookups of a name. Needed when modifying a variable through a pointer from w_ctx_get.
+w_ctx_t w_ctx_clone(w_ctx_t *ctx); /// Creates a context for a new scope inside of ctx. This doesn't copy any variables.
+w_ctx_t w_ctx_enter(w_ctx_t *ctx, w_layout_t *layout); /// Same as w_ctx_clone, but gives the new scope a frame with the given layout (which may be NULL) if it has slots.
 void w_ctx_free(w_ctx_t *ctx); /// Frees a context
+bool w_ctx_droppable(w_ctx_t *ctx, w_frame_t *until, w_cmd_t *cmd); /// Whether the frames between ctx and until can be dropped before calling cmd without it noticing, because everything they hold is shadowed by cmd's arguments.
+
+
+w_value_t w_eval_string(w_ast_t *ast); /// Evaluates a string literal
+bool w_ast_inert(w_ast_t *ast); /// Whether evaluating an AST can't change any value, so that values borrowed before it stay valid
+bool w_eval_borrowed(w_ctx_t *ctx, w_ast_t *ast, w_value_t *this, w_value_t *out); /// Evaluates into out without referencing variables and cached string literals. Returns whether out is owned and has to be released; borrowed values are only valid until something that isn't inert is evaluated.
+w_value_t w_eval_index(w_ctx_t *ctx, w_ast_t *ast, w_value_t *left, w_value_t *right); /// Indexes the evaluated sides of an index AST. Unlike w_value_index, this gives a file position.
+void w_ast_unquicken(w_ast_t *ast); /// Returns an AST node to its generic form, freeing the data of its specialized form
 
+w_value_t w_make_command(w_externcmd_t fp); /// Creates a lazy external command
+w_value_t w_make_strict_command(w_strictcmd_t fp, bool borrow); /// Creates a strict external command. borrow is set for commands that neither keep nor modify their arguments.
+w_value_t w_ecmd_call(w_ctx_t *ctx, w_ecmd_t *ecmd, w_ast_t *name, w_args_t args, w_value_t *this); /// Calls the external command that name evaluated to with arguments as ASTs, evaluating them first if it's strict
+w_value_t w_ecmd_invoke(w_ctx_t *ctx, w_ecmd_t *ecmd, w_ast_t *name, size_t argc, w_value_t *argv, w_ast_t *asts); /// Calls the strict external command that name evaluated to with evaluated arguments. If name is a member of a variable being read for the last time (see w_ast_t.last), the member's object is moved out of the variable for the call when nothing else refers to it, so that it can be changed in place.
+w_value_t w_method_call(w_ctx_t *ctx, w_strictcmd_t method, w_value_t *obj, w_ast_t *name, w_args_t args, w_value_t *this); /// Evaluates the arguments of a call to a method of obj (see w_value_method), and calls it on obj without binding it first
+w_value_t w_method_invoke(w_ctx_t *ctx, w_strictcmd_t method, w_value_t *obj, w_ast_t *name, size_t argc, w_value_t *argv, w_ast_t *asts); /// Same as w_ecmd_invoke, for a method called on obj directly
+w_value_t w_cmd_call(w_ctx_t *ctx, w_cmd_t *cmd, size_t argc, w_value_t *argv, w_value_t *this); /// Calls an internal command with already evaluated arguments, which are consumed. Missing arguments are null.
 
 w_value_t w_eval(w_ctx_t *ctx, w_ast_t *ast); /// Evaluates an AST
 w_value_t w_evals(w_ctx_t *ctx, w_ctx_t *sub, w_ast_t *ast); /// Evaluates with a subcontext
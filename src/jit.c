@@ -0,0 +1,303 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "jit.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// the templates address these directly
+_Static_assert(sizeof(w_value_t) == 16 && offsetof(w_value_t, int_) == 8, "unexpected w_value_t layout");
+_Static_assert(offsetof(w_vm_t, budget) < 128, "w_vm_t fields used by native code must be in reach of an 8-bit displacement");
+_Static_assert(offsetof(w_budget_t, slice) == 0, "unexpected w_budget_t layout");
+
+#define STACK offsetof(w_vm_t, stack)
+#define SP offsetof(w_vm_t, sp)
+#define INSN offsetof(w_vm_t, insn)
+#define BUDGET offsetof(w_vm_t, budget)
+#define INT W_VALUE_INT
+
+// jump targets that aren't instructions
+#define EXIT_END ((size_t)-1)
+#define EXIT_UNWIND ((size_t)-2)
+
+// a 32-bit relative jump, patched once every instruction has been emitted
+typedef struct fixup {
+	size_t at; // offset of the displacement
+	size_t target; // instruction index, or one of the exits
+} fixup_t;
+
+typedef struct jit_state {
+	uint8_t *code;
+	size_t len, cap;
+	fixup_t *fixups;
+	size_t fixups_len, fixups_cap;
+} jit_state_t;
+
+static void emit(jit_state_t *j, const uint8_t *bytes, size_t n) {
+	if(j->len+n > j->cap) {
+		while(j->len+n > j->cap)
+			j->cap = j->cap == 0 ? 4096 : j->cap*2;
+		j->code = realloc(j->code, j->cap);
+	}
+	memcpy(j->code+j->len, bytes, n);
+	j->len += n;
+}
+
+#define EMIT(...) { \
+	uint8_t bytes[] = {__VA_ARGS__}; \
+	emit(j, bytes, sizeof(bytes)); \
+}
+
+static void emit64(jit_state_t *j, uint64_t v) {
+	emit(j, (uint8_t *)&v, 8);
+}
+
+// emits a jump instruction (given without its displacement) to target
+static void jump(jit_state_t *j, const uint8_t *op, size_t n, size_t target) {
+	emit(j, op, n);
+	if(j->fixups_len >= j->fixups_cap) {
+		j->fixups_cap = j->fixups_cap == 0 ? 64 : j->fixups_cap*2;
+		j->fixups = realloc(j->fixups, sizeof(fixup_t)*j->fixups_cap);
+	}
+	j->fixups[j->fixups_len++] = (fixup_t){j->len, target};
+	EMIT(0, 0, 0, 0);
+}
+
+#define JMP(TARGET) jump(j, (uint8_t []){0xe9}, 1, TARGET)
+#define JE(TARGET) jump(j, (uint8_t []){0x0f, 0x84}, 2, TARGET)
+
+// rdx = &vm->stack[vm->sp]
+static void top(jit_state_t *j) {
+	EMIT(0x48, 0x8b, 0x43, SP); // mov rax, [rbx+SP]
+	EMIT(0x48, 0x8b, 0x53, STACK); // mov rdx, [rbx+STACK]
+	EMIT(0x48, 0xc1, 0xe0, 0x04); // shl rax, 4
+	EMIT(0x48, 0x01, 0xc2); // add rdx, rax
+}
+
+// checks that the two values on top of the stack are ints, going to the instruction's generic code otherwise. returns the offset
+// of the jumps to land.
+static size_t int_pair(jit_state_t *j) {
+	top(j);
+	EMIT(0x83, 0x7a, 0xe0, INT); // cmp dword [rdx-32], INT
+	EMIT(0x75, 0x00); // jne generic
+	EMIT(0x83, 0x7a, 0xf0, INT); // cmp dword [rdx-16], INT
+	EMIT(0x75, 0x00); // jne generic
+	return j->len-7;
+}
+
+// points int_pair's jumps at the current offset
+static void land(jit_state_t *j, size_t at) {
+	j->code[at] = j->len-(at+1);
+	j->code[at+6] = j->len-(at+7);
+}
+
+// whether an instruction can jump to its arg
+static bool jumps(w_opcode_t op) {
+	switch(op) {
+		case W_OP_LOOKUP:
+		case W_OP_CALL:
+		case W_OP_METHOD:
+		case W_OP_ARG:
+		case W_OP_GUARD:
+		case W_OP_JUMP:
+		case W_OP_JUMP_IF_NOT:
+		case W_OP_LOOP:
+		case W_OP_FOR_INIT:
+		case W_OP_FOR_NEXT:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// calls the instruction's implementation, and acts on its result
+static void generic(jit_state_t *j, w_insn_t *insn) {
+	EMIT(0x48, 0x89, 0xdf); // mov rdi, rbx
+	EMIT(0x48, 0xbe); // mov rsi, insn
+	emit64(j, (uint64_t)insn);
+	EMIT(0x48, 0xb8); // mov rax, op
+	emit64(j, (uint64_t)w_vm_ops[insn->op]);
+	EMIT(0xff, 0xd0); // call rax
+	EMIT(0x85, 0xc0); // test eax, eax
+	bool j1 = jumps(insn->op);
+	EMIT(0x74, j1 ? 24 : 15); // jz next
+	if(j1) {
+		EMIT(0x83, 0xf8, W_VM_JUMP); // cmp eax, W_VM_JUMP
+		JE(insn->arg);
+	}
+	EMIT(0x48, 0xb9); // mov rcx, insn
+	emit64(j, (uint64_t)insn);
+	JMP(EXIT_UNWIND);
+}
+
+// compiles an arithmetic instruction, with an inline path for ints
+static void arith(jit_state_t *j, w_insn_t *insn, size_t index) {
+	size_t slow = int_pair(j);
+	EMIT(0x48, 0x8b, 0x42, 0xf8); // mov rax, [rdx-8]
+	switch(insn->op) {
+		case W_OP_ADD:
+			EMIT(0x48, 0x01, 0x42, 0xe8); // add [rdx-24], rax
+			break;
+		case W_OP_SUB:
+			EMIT(0x48, 0x29, 0x42, 0xe8); // sub [rdx-24], rax
+			break;
+		default:
+			EMIT(0x48, 0x8b, 0x4a, 0xe8); // mov rcx, [rdx-24]
+			EMIT(0x48, 0x0f, 0xaf, 0xc8); // imul rcx, rax
+			EMIT(0x48, 0x89, 0x4a, 0xe8); // mov [rdx-24], rcx
+			break;
+	}
+	EMIT(0x48, 0xff, 0x4b, SP); // dec qword [rbx+SP]
+	JMP(index+1);
+	land(j, slow);
+	generic(j, insn);
+}
+
+// compiles a comparison, with an inline path for ints
+static void compare(jit_state_t *j, w_insn_t *insn, size_t index) {
+	static uint8_t setcc[] = {
+		[W_OP_EQU] = 0x94, [W_OP_NEQ] = 0x95, [W_OP_LT] = 0x9c, [W_OP_LTE] = 0x9e, [W_OP_GT] = 0x9f, [W_OP_GTE] = 0x9d
+	};
+	size_t slow = int_pair(j);
+	EMIT(0x48, 0x8b, 0x42, 0xe8); // mov rax, [rdx-24]
+	EMIT(0x48, 0x3b, 0x42, 0xf8); // cmp rax, [rdx-8]
+	EMIT(0x0f, setcc[insn->op], 0xc0); // setcc al
+	EMIT(0x0f, 0xb6, 0xc0); // movzx eax, al
+	EMIT(0x48, 0x89, 0x42, 0xe8); // mov [rdx-24], rax
+	EMIT(0x48, 0xff, 0x4b, SP); // dec qword [rbx+SP]
+	JMP(index+1);
+	land(j, slow);
+	generic(j, insn);
+}
+
+void w_jit_compile(w_chunk_t *chunk) {
+	jit_state_t state = (jit_state_t){NULL, 0, 0, NULL, 0, 0};
+	jit_state_t *j = &state;
+	uint32_t *offsets = malloc(sizeof(uint32_t)*chunk->len);
+	// entry point: w_vm_result_t entry(w_vm_t *vm, void *target)
+	EMIT(0x53); // push rbx
+	EMIT(0x48, 0x89, 0xfb); // mov rbx, rdi
+	EMIT(0xff, 0xe6); // jmp rsi
+	size_t exit_end = j->len;
+	EMIT(0xb8, W_VM_END, 0, 0, 0); // mov eax, W_VM_END
+	EMIT(0x5b, 0xc3); // pop rbx; ret
+	size_t exit_unwind = j->len;
+	EMIT(0x48, 0x89, 0x4b, INSN); // mov [rbx+INSN], rcx
+	EMIT(0xb8, W_VM_UNWIND, 0, 0, 0); // mov eax, W_VM_UNWIND
+	EMIT(0x5b, 0xc3); // pop rbx; ret
+	for(size_t i = 0; i < chunk->len; i++) {
+		w_insn_t *insn = &chunk->code[i];
+		offsets[i] = j->len;
+		switch(insn->op) {
+			case W_OP_INT:
+				top(j);
+				EMIT(0xc7, 0x02, INT, 0, 0, 0); // mov dword [rdx], INT
+				EMIT(0x48, 0xb8); // mov rax, int_
+				emit64(j, (uint64_t)insn->int_);
+				EMIT(0x48, 0x89, 0x42, 0x08); // mov [rdx+8], rax
+				EMIT(0x48, 0xff, 0x43, SP); // inc qword [rbx+SP]
+				break;
+			case W_OP_JUMP:
+				JMP(insn->arg);
+				break;
+			case W_OP_LOOP:
+				EMIT(0x48, 0x8b, 0x43, BUDGET); // mov rax, [rbx+BUDGET]
+				EMIT(0x48, 0x85, 0xc0); // test rax, rax
+				JE(insn->arg);
+				EMIT(0x48, 0x83, 0x38, 0x00); // cmp qword [rax], 0
+				EMIT(0x7e, 8); // jle generic
+				EMIT(0x48, 0xff, 0x08); // dec qword [rax]
+				JMP(insn->arg);
+				generic(j, insn);
+				break;
+			case W_OP_JUMP_IF_NOT: {
+				top(j);
+				EMIT(0x83, 0x7a, 0xf0, INT); // cmp dword [rdx-16], INT
+				EMIT(0x75, 0x00); // jne generic
+				size_t slow = j->len-1;
+				EMIT(0x48, 0xff, 0x4b, SP); // dec qword [rbx+SP]
+				EMIT(0x48, 0x83, 0x7a, 0xf8, 0x00); // cmp qword [rdx-8], 0
+				JE(insn->arg);
+				JMP(i+1);
+				j->code[slow] = j->len-(slow+1);
+				generic(j, insn);
+				break;
+			}
+			case W_OP_ADD:
+			case W_OP_SUB:
+			case W_OP_MUL:
+				arith(j, insn, i);
+				break;
+			case W_OP_EQU:
+			case W_OP_NEQ:
+			case W_OP_LT:
+			case W_OP_LTE:
+			case W_OP_GT:
+			case W_OP_GTE:
+				compare(j, insn, i);
+				break;
+			case W_OP_END:
+				JMP(EXIT_END);
+				break;
+			default:
+				generic(j, insn);
+				break;
+		}
+	}
+	// resolve jumps
+	for(size_t i = 0; i < j->fixups_len; i++) {
+		fixup_t *f = &j->fixups[i];
+		size_t target = f->target == EXIT_END ? exit_end : f->target == EXIT_UNWIND ? exit_unwind : offsets[f->target];
+		int32_t rel = (int64_t)target-(int64_t)(f->at+4);
+		memcpy(j->code+f->at, &rel, 4);
+	}
+	free(j->fixups);
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t size = (j->len+page-1)/page*page;
+	uint8_t *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(mem == MAP_FAILED) {
+		free(j->code);
+		free(offsets);
+		return;
+	}
+	memcpy(mem, j->code, j->len);
+	free(j->code);
+	if(mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(mem, size);
+		free(offsets);
+		return;
+	}
+	w_jit_t *jit = malloc(sizeof(w_jit_t));
+	*jit = (w_jit_t){mem, size, offsets};
+	chunk->jit = jit;
+}
+
+w_vm_result_t w_jit_run(w_chunk_t *chunk, w_vm_t *vm, w_insn_t *ip) {
+	w_jit_t *jit = chunk->jit;
+	w_vm_result_t (*entry)(w_vm_t *, void *) = (w_vm_result_t (*)(w_vm_t *, void *))jit->code;
+	return entry(vm, jit->code+jit->offsets[ip-chunk->code]);
+}
+
+void w_jit_free(w_jit_t *jit) {
+	munmap(jit->code, jit->size);
+	free(jit->offsets);
+	free(jit);
+}
+
+#else
+
+// there's nothing to compile to on other platforms, so chunks are always interpreted
+
+void w_jit_compile(w_chunk_t *chunk) {}
+
+w_vm_result_t w_jit_run(w_chunk_t *chunk, w_vm_t *vm, w_insn_t *ip) {
+	return W_VM_UNWIND;
+}
+
+void w_jit_free(w_jit_t *jit) {}
+
+#endif
@@ -0,0 +1,21 @@
+/// Describes the JIT, which compiles hot chunks to native code
+
+#ifndef W_JIT_H
+#define W_JIT_H
+
+#include <stdint.h>
+
+#include "vm.h"
+
+/// Native code for a chunk. It works on the same w_vm_t as the interpreter, and can be entered at any instruction.
+struct w_jit {
+	uint8_t *code; /// Executable mapping, starting with the entry point
+	size_t size; /// Size of the mapping
+	uint32_t *offsets; /// Offset of the code for each instruction
+};
+
+void w_jit_compile(w_chunk_t *chunk); /// Compiles a chunk to native code. chunk->jit stays NULL if this platform isn't supported.
+w_vm_result_t w_jit_run(w_chunk_t *chunk, w_vm_t *vm, w_insn_t *ip); /// Runs a chunk's native code from ip until the chunk ends or has to unwind
+void w_jit_free(w_jit_t *jit); /// Frees native code
+
+#endif
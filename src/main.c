@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <errno.h>
 #ifdef HAS_READLINE
 	#include <readline/readline.h>
 	#include <readline/history.h>
@@ -10,8 +11,32 @@
 #include "parser.h"
 #include "interpreter.h"
 #include "info.h"
+#include "cgen.h"
+#include "optimizer.h"
 #include "main.h"
 
+// parses a non-negative integer option value, returning false if str isn't one
+static bool parse_count(char *str, int64_t *out) {
+	char *end;
+	errno = 0;
+	long long n = strtoll(str, &end, 10);
+	if(end == str || *end != '\0' || errno != 0 || n < 0)
+		return false;
+	*out = n;
+	return true;
+}
+
+// same as above, for a number of seconds
+static bool parse_seconds(char *str, double *out) {
+	char *end;
+	errno = 0;
+	double n = strtod(str, &end);
+	if(end == str || *end != '\0' || errno != 0 || !(n >= 0))
+		return false;
+	*out = n;
+	return true;
+}
+
 int main(int argc, char **argv) {
 	// run interpreter if no arguments
 	if(argc == 1) {
@@ -19,6 +44,9 @@ int main(int argc, char **argv) {
 		return 0;
 	}
 	// TODO: better program argument parsing
+	bool emit_c = false, dump_ast = false;
+	int64_t fuel = -1;
+	double timeout = 0;
 	size_t i;
 	for(i = 1; i < argc; i++) {
 		char *arg = argv[i];
@@ -30,12 +58,92 @@ int main(int argc, char **argv) {
 				printf("Running with no arguments will launch an interactive REPL mode. Running with filename '-' will read the program from stdin.\n\n");
 				printf("Interpreter Arguments:\n");
 				printf("-h | --help\tShows this help information\n");
+				printf("--tree-walk\tEvaluates the AST directly instead of compiling it to bytecode\n");
+				printf("--jit\t\tCompiles hot loops and commands to native code (x86-64 Linux only)\n");
+				printf("--no-jit\tTurns the JIT back off (the default)\n");
+				printf("--jit-hot <n>\tNumber of entries or loop iterations after which code is compiled (default %zu)\n", w_options.jit_hot);
+				printf("--no-fold\tRuns programs as they were written, without folding constants and dropping dead branches first\n");
+				printf("--lazy\t\tParses the bodies of commands when they're first called instead of at startup\n");
+				printf("--fuel <n>\tStops the program with an error after it takes n steps (commands, calls and loop iterations)\n");
+				printf("--timeout <s>\tStops the program with an error once it's ran for s seconds\n");
+				printf("--dump-ast\tPrints the AST before and after it's optimized instead of running it\n");
+				printf("--emit-c\tWrites the program as C to stdout instead of running it. Build it with every file in src/ except main.c.\n");
 				return 0;
 			}
+			if(strcmp(arg, "--tree-walk") == 0) {
+				w_options.vm = false;
+				continue;
+			}
+			if(strcmp(arg, "--jit") == 0) {
+				w_options.jit = true;
+				continue;
+			}
+			if(strcmp(arg, "--no-jit") == 0) {
+				w_options.jit = false;
+				continue;
+			}
+			if(strcmp(arg, "--no-fold") == 0) {
+				w_options.fold = false;
+				continue;
+			}
+			if(strcmp(arg, "--lazy") == 0) {
+				w_options.lazy = true;
+				continue;
+			}
+			if(strcmp(arg, "--dump-ast") == 0) {
+				dump_ast = true;
+				continue;
+			}
+			if(strcmp(arg, "--emit-c") == 0) {
+				emit_c = true;
+				continue;
+			}
+			if(strcmp(arg, "--fuel") == 0) {
+				if(i+1 == argc) {
+					printf("--fuel needs a value. See --help for usage.\n");
+					return 1;
+				}
+				if(!parse_count(argv[++i], &fuel)) {
+					printf("--fuel takes a number of steps that's 0 or more, got '%s'. See --help for usage.\n", argv[i]);
+					return 1;
+				}
+				continue;
+			}
+			if(strcmp(arg, "--timeout") == 0) {
+				if(i+1 == argc) {
+					printf("--timeout needs a value. See --help for usage.\n");
+					return 1;
+				}
+				if(!parse_seconds(argv[++i], &timeout)) {
+					printf("--timeout takes a number of seconds that's 0 or more, got '%s'. See --help for usage.\n", argv[i]);
+					return 1;
+				}
+				continue;
+			}
+			if(strcmp(arg, "--jit-hot") == 0) {
+				if(i+1 == argc) {
+					printf("--jit-hot needs a value. See --help for usage.\n");
+					return 1;
+				}
+				int64_t hot;
+				if(!parse_count(argv[++i], &hot)) {
+					printf("--jit-hot takes a count that's 0 or more, got '%s'. See --help for usage.\n", argv[i]);
+					return 1;
+				}
+				w_options.jit_hot = hot;
+				continue;
+			}
 			continue;	
 		}
 		break;
 	}
+	if(i == argc) {
+		printf("No file given. See --help for usage.\n");
+		return 1;
+	}
+	// both of these need the whole program
+	if(dump_ast || emit_c)
+		w_options.lazy = false;
 	char *filename = argv[i];
 	FILE *fp;
 	if(strcmp(filename, "-") == 0)
@@ -71,19 +179,45 @@ int main(int argc, char **argv) {
 		free(code);
 		return 2;
 	}
+	if(dump_ast) {
+		printf("before: ");
+		w_ast_print(&ast);
+		printf("\n");
+	}
+	if(w_options.fold)
+		w_optimize(&ast);
+	if(dump_ast) {
+		printf("after: ");
+		w_ast_print(&ast);
+		printf("\n");
+		w_ast_free(&ast);
+		free(code);
+		return 0;
+	}
+	if(emit_c) {
+		w_cgen(&ast, stdout);
+		w_ast_free(&ast);
+		free(code);
+		return 0;
+	}
+	// commands made while running keep the tree alive past this point, if they're still around
+	w_tree_t *tree = w_tree_new(ast);
 	w_ctx_t ctx = w_default_ctx(&status);
-	w_value_t val = w_eval(&ctx, &ast);
+	w_budget_t budget = w_budget_new(fuel, timeout);
+	if(fuel >= 0 || timeout > 0)
+		ctx.budget = &budget;
+	w_value_t val = w_eval(&ctx, &tree->ast);
 	if(status.tag != W_STATUS_OK) {
 		w_error_print(status.err, stdout);
 		w_status_free(&status);
 		w_ctx_free(&ctx);
-		w_ast_free(&ast);
+		w_tree_release(tree);
 		free(code);
 		return 2;
 	}
 	w_value_release(&val);
 	w_ctx_free(&ctx);
-	w_ast_free(&ast);
+	w_tree_release(tree);
 	free(code);
 }
 
@@ -125,10 +259,12 @@ void repl(void) {
 			continue;
 		}
 		// goto skip;
-		w_value_t val = w_evals(&ctx, &sub_ctx, &ast);
+		// commands defined by the line keep it alive once it's released
+		w_tree_t *tree = w_tree_new(ast);
+		w_value_t val = w_evals(&ctx, &sub_ctx, &tree->ast);
 		if(status.tag == W_STATUS_ERR) {
 			w_error_print(status.err, stdout);
-			w_ast_free(&ast);
+			w_tree_release(tree);
 			free(line);
 			continue;
 		}
@@ -139,7 +275,7 @@ void repl(void) {
 		// skip:
 		// w_ast_print(&ast);
 		printf("\n");
-		w_ast_free(&ast);
+		w_tree_release(tree);
 		free(line);
 	}
 	w_ctx_free(&ctx);
@@ -0,0 +1,377 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "optimizer.h"
+#include "resolver.h"
+#include "interpreter.h"
+
+/// How calls to a builtin are folded
+typedef enum fold_kind {
+	FOLD_ARITH, // numbers, through arith
+	FOLD_CMP, // two numbers, through cmp
+	FOLD_EQU, FOLD_NEQ, // two literals
+	FOLD_AND, FOLD_OR, // literals
+	FOLD_CONV, // a literal, through conv
+	FOLD_LIST // ints, floats and nulls, into a constant list
+} fold_kind_t;
+
+/// A builtin that can be folded
+typedef struct fold {
+	char *name;
+	fold_kind_t kind;
+	w_value_t (*arith)(w_ctx_t *ctx, w_value_t *a, w_value_t *b);
+	bool (*cmp)(w_ctx_t *ctx, w_value_t *a, w_value_t *b);
+	w_value_t (*conv)(w_value_t *v);
+} fold_t;
+
+static const fold_t folds[] = {
+	{"+", FOLD_ARITH, .arith = &w_value_add},
+	{"-", FOLD_ARITH, .arith = &w_value_sub},
+	{"*", FOLD_ARITH, .arith = &w_value_mul},
+	{"/", FOLD_ARITH, .arith = &w_value_div},
+	{"%", FOLD_ARITH, .arith = &w_value_mod},
+	{"<", FOLD_CMP, .cmp = &w_value_lt},
+	{"<=", FOLD_CMP, .cmp = &w_value_lte},
+	{">", FOLD_CMP, .cmp = &w_value_gt},
+	{">=", FOLD_CMP, .cmp = &w_value_gte},
+	{"=", FOLD_EQU},
+	{"!=", FOLD_NEQ},
+	{"&", FOLD_AND},
+	{"|", FOLD_OR},
+	{"int", FOLD_CONV, .conv = &w_value_toint},
+	{"float", FOLD_CONV, .conv = &w_value_tofloat},
+	{"string", FOLD_CONV, .conv = &w_value_tostring},
+	{"list", FOLD_LIST}
+};
+
+/// Optimizer state
+typedef struct optimizer {
+	size_t len, cap;
+	w_astring_t *names; // name of every variable in the program
+} optimizer_t;
+
+static void add_name(optimizer_t *o, w_astring_t *name) {
+	for(size_t i = 0; i < o->len; i++)
+		if(w_astreq(&o->names[i], name))
+			return;
+	if(o->len >= o->cap) {
+		o->cap = o->cap == 0 ? 16 : o->cap*2;
+		o->names = realloc(o->names, sizeof(w_astring_t)*o->cap);
+	}
+	o->names[o->len++] = w_astrdup(name);
+}
+
+// collects the names of variables. any of these could be bound at runtime, shadowing a builtin of the same name.
+static void collect(optimizer_t *o, w_ast_t *ast) {
+	switch(ast->type) {
+		case W_AST_VAR:
+			add_name(o, &ast->string);
+			break;
+		case W_AST_INDEX:
+			collect(o, ast->index.left);
+			collect(o, ast->index.right);
+			break;
+		case W_AST_COMMANDS:
+			if(ast->commands.source != NULL) {
+				// a body that hasn't been parsed only has its variables scanned
+				size_t len;
+				w_astring_t *names = w_ast_lazy_vars(ast, &len);
+				for(size_t i = 0; i < len; i++)
+					add_name(o, &names[i]);
+				free(names);
+				break;
+			}
+			for(size_t i = 0; i < ast->commands.len; i++)
+				for(size_t j = 0; j < ast->commands.ptr[i].len; j++)
+					collect(o, &ast->commands.ptr[i].ptr[j]);
+			break;
+		default:
+			break;
+	}
+}
+
+// whether a builtin could have been rebound
+static bool rebound(optimizer_t *o, char *builtin) {
+	for(size_t i = 0; i < o->len; i++)
+		if(w_astreqc(&o->names[i], builtin))
+			return true;
+	return false;
+}
+
+// whether name refers to the builtin with the given name
+static bool builtin(optimizer_t *o, w_ast_t *name, char *builtin) {
+	return name->type == W_AST_STRING && w_astreqc(&name->string, builtin) && !rebound(o, builtin);
+}
+
+static bool numeric(w_ast_t *ast) {
+	return ast->type == W_AST_INT || ast->type == W_AST_FLOAT;
+}
+
+// whether ast evaluates to the same value every time, without side effects
+static bool constant(w_ast_t *ast) {
+	switch(ast->type) {
+		case W_AST_STRING:
+		case W_AST_INT:
+		case W_AST_FLOAT:
+		case W_AST_NULL:
+		case W_AST_CONST:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// gets the value of a literal. returns false if ast isn't one. the value has to be released.
+static bool literal(w_ast_t *ast, w_value_t *v) {
+	switch(ast->type) {
+		case W_AST_INT:
+			*v = (w_value_t){.type = W_VALUE_INT, .int_ = ast->int_};
+			return true;
+		case W_AST_FLOAT:
+			*v = (w_value_t){.type = W_VALUE_FLOAT, .float_ = ast->float_};
+			return true;
+		case W_AST_NULL:
+			*v = (w_value_t){.type = W_VALUE_NULL};
+			return true;
+		case W_AST_STRING: {
+			w_string_t *str = malloc(sizeof(w_string_t));
+			*str = (w_string_t){1, ast->string.len, malloc(ast->string.len), ast->string.hash};
+			if(str->len != 0)
+				memcpy(str->ptr, ast->string.ptr, str->len);
+			*v = (w_value_t){.type = W_VALUE_STRING, .string = str};
+			return true;
+		}
+		default:
+			return false;
+	}
+}
+
+// makes a literal out of a value returned by a fold (an int, float, null or string)
+static w_ast_t from_value(w_value_t *v, w_filepos_t pos) {
+	switch(v->type) {
+		case W_VALUE_INT:
+			return (w_ast_t){.type = W_AST_INT, .pos = pos, .int_ = v->int_};
+		case W_VALUE_FLOAT:
+			return (w_ast_t){.type = W_AST_FLOAT, .pos = pos, .float_ = v->float_};
+		case W_VALUE_STRING: {
+			w_astring_t str = w_string_key(v->string);
+			return (w_ast_t){.type = W_AST_STRING, .pos = pos, .string = w_astrdup(&str)};
+		}
+		default:
+			return (w_ast_t){.type = W_AST_NULL, .pos = pos};
+	}
+}
+
+// folds a call to a pure builtin into out, if all of its arguments are literals
+static bool fold_call(optimizer_t *o, w_ast_command_t *cmd, w_filepos_t pos, w_ast_t *out) {
+	const fold_t *f = NULL;
+	for(size_t i = 0; i < sizeof(folds)/sizeof(fold_t) && f == NULL; i++)
+		if(builtin(o, &cmd->ptr[0], folds[i].name))
+			f = &folds[i];
+	if(f == NULL)
+		return false;
+	size_t argc = cmd->len-1;
+	w_ast_t *args = cmd->ptr+1;
+	for(size_t i = 0; i < argc; i++) {
+		if(!constant(&args[i]) || args[i].type == W_AST_CONST)
+			return false;
+		if((f->kind == FOLD_ARITH || f->kind == FOLD_CMP || f->kind == FOLD_LIST) && !numeric(&args[i]) && args[i].type != W_AST_NULL)
+			return false;
+	}
+	w_value_t res, a, b;
+	switch(f->kind) {
+		case FOLD_ARITH:
+			if(argc < 1 || args[0].type == W_AST_NULL)
+				return false;
+			literal(&args[0], &res);
+			for(size_t i = 1; i < argc; i++) {
+				if(!literal(&args[i], &b) || b.type == W_VALUE_NULL)
+					return false;
+				// integer division by zero is left to happen at runtime
+				bool divides = f->arith == &w_value_div || f->arith == &w_value_mod;
+				if(divides && res.type == W_VALUE_INT && b.type == W_VALUE_INT && (b.int_ == 0 || (b.int_ == -1 && res.int_ == INT64_MIN)))
+					return false;
+				// numbers never fail, so no context is needed
+				res = f->arith(NULL, &res, &b);
+			}
+			break;
+		case FOLD_CMP:
+			if(argc != 2 || !numeric(&args[0]) || !numeric(&args[1]))
+				return false;
+			literal(&args[0], &a);
+			literal(&args[1], &b);
+			res = (w_value_t){.type = W_VALUE_INT, .int_ = f->cmp(NULL, &a, &b) ? 1 : 0};
+			break;
+		case FOLD_EQU:
+		case FOLD_NEQ: {
+			if(argc != 2)
+				return false;
+			literal(&args[0], &a);
+			literal(&args[1], &b);
+			bool eq = w_value_equal(&a, &b);
+			w_value_release(&a);
+			w_value_release(&b);
+			res = (w_value_t){.type = W_VALUE_INT, .int_ = eq == (f->kind == FOLD_EQU) ? 1 : 0};
+			break;
+		}
+		case FOLD_AND:
+		case FOLD_OR: {
+			if(argc < 2)
+				return false;
+			// the first argument that decides the result is the result
+			bool want = f->kind == FOLD_OR;
+			res = (w_value_t){.type = W_VALUE_INT, .int_ = want ? 0 : 1};
+			for(size_t i = 0; i < argc; i++) {
+				literal(&args[i], &a);
+				if(w_value_truthy(&a) == want) {
+					res = a;
+					break;
+				}
+				w_value_release(&a);
+			}
+			break;
+		}
+		case FOLD_CONV:
+			if(argc != 1)
+				return false;
+			literal(&args[0], &a);
+			res = f->conv(&a);
+			w_value_release(&a);
+			break;
+		case FOLD_LIST: {
+			w_list_t *l = malloc(sizeof(w_list_t));
+			*l = (w_list_t){1, argc, malloc(sizeof(w_value_t)*argc)};
+			for(size_t i = 0; i < argc; i++)
+				literal(&args[i], &l->ptr[i]);
+			w_value_t *value = malloc(sizeof(w_value_t));
+			*value = (w_value_t){.type = W_VALUE_LIST, .list = l};
+			*out = (w_ast_t){.type = W_AST_CONST, .pos = pos, .value = value};
+			return true;
+		}
+	}
+	*out = from_value(&res, pos);
+	w_value_release(&res);
+	return true;
+}
+
+// drops the branches of an if command that can never be taken. an if that ends up with nothing to check becomes a do.
+static void prune_if(optimizer_t *o, w_ast_command_t *cmd) {
+	if(cmd->len < 3 || !builtin(o, &cmd->ptr[0], "if"))
+		return;
+	size_t argc = cmd->len-1;
+	w_ast_t *args = cmd->ptr+1;
+	size_t conds = argc/2;
+	bool *keep = calloc(argc, sizeof(bool));
+	w_ast_t *taken = NULL; // branch taken when none of the kept conditions are true
+	bool changed = false;
+	for(size_t i = 0; i < conds && taken == NULL; i++) {
+		w_value_t v;
+		if(!literal(&args[i*2], &v)) {
+			keep[i*2] = keep[i*2+1] = true;
+			continue;
+		}
+		changed = true;
+		if(w_value_truthy(&v))
+			taken = &args[i*2+1];
+		w_value_release(&v);
+	}
+	if(taken == NULL && conds*2 != argc)
+		taken = &args[argc-1];
+	size_t len = 0;
+	for(size_t i = 0; i < argc; i++)
+		len += keep[i];
+	if(!changed || (len == 0 && rebound(o, "do"))) {
+		free(keep);
+		return;
+	}
+	w_ast_t *ptr = malloc(sizeof(w_ast_t)*(len+2));
+	ptr[0] = cmd->ptr[0];
+	len = 1;
+	for(size_t i = 0; i < argc; i++) {
+		if(keep[i])
+			ptr[len++] = args[i];
+		else if(&args[i] != taken)
+			w_ast_free(&args[i]);
+	}
+	if(taken != NULL)
+		ptr[len++] = *taken;
+	if(len == 1) {
+		// every condition was false
+		ptr[len++] = (w_ast_t){.type = W_AST_NULL, .pos = cmd->ptr[0].pos};
+	}
+	if(len == 2) {
+		free(ptr[0].string.ptr);
+		w_astring_t name = (w_astring_t){2, "do"};
+		ptr[0].string = w_astrdup(&name);
+	}
+	free(cmd->ptr);
+	free(keep);
+	*cmd = (w_ast_command_t){len, ptr, NULL};
+}
+
+// replaces a block that only calls a pure builtin with literals by the result, and a block that only does something by that thing
+static void fold_expr(optimizer_t *o, w_ast_t *ast) {
+	if(ast->type != W_AST_COMMANDS || ast->commands.len != 1)
+		return;
+	w_ast_command_t *cmd = &ast->commands.ptr[0];
+	w_ast_t out;
+	if(cmd->len == 2 && builtin(o, &cmd->ptr[0], "do") && (constant(&cmd->ptr[1]) || cmd->ptr[1].type == W_AST_COMMANDS)) {
+		out = cmd->ptr[1];
+		cmd->ptr[1] = (w_ast_t){.type = W_AST_NULL};
+	}
+	else if(!fold_call(o, cmd, ast->pos, &out))
+		return;
+	w_ast_free(ast);
+	*ast = out;
+}
+
+static void optimize(optimizer_t *o, w_ast_t *ast) {
+	switch(ast->type) {
+		case W_AST_INDEX:
+			optimize(o, ast->index.left);
+			fold_expr(o, ast->index.left);
+			optimize(o, ast->index.right);
+			fold_expr(o, ast->index.right);
+			// a member name folded from a block is resolved like a literal one
+			if(ast->index.right->type == W_AST_STRING)
+				ast->index.right->member = w_member_find(&ast->index.right->string);
+			break;
+		case W_AST_COMMANDS: {
+			w_ast_commands_t *cmds = &ast->commands;
+			for(size_t i = 0; i < cmds->len; i++) {
+				w_ast_command_t *cmd = &cmds->ptr[i];
+				for(size_t j = 0; j < cmd->len; j++) {
+					optimize(o, &cmd->ptr[j]);
+					// the command's name is left alone, a block there has to evaluate to a command anyways
+					if(j != 0)
+						fold_expr(o, &cmd->ptr[j]);
+				}
+				prune_if(o, cmd);
+				// a constant does nothing unless it's the result of the block
+				if(i+1 < cmds->len && cmd->len == 2 && builtin(o, &cmd->ptr[0], "do") && constant(&cmd->ptr[1])) {
+					for(size_t j = 0; j < cmd->len; j++)
+						w_ast_free(&cmd->ptr[j]);
+					free(cmd->ptr);
+					memmove(cmd, cmd+1, sizeof(w_ast_command_t)*(cmds->len-i-1));
+					cmds->len--;
+					i--;
+				}
+			}
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+void w_optimize(w_ast_t *ast) {
+	optimizer_t o = (optimizer_t){0, 0, NULL};
+	collect(&o, ast);
+	// blocks can be removed or moved, so the AST is resolved again afterwards
+	w_unresolve(ast);
+	optimize(&o, ast);
+	w_resolve(ast);
+	for(size_t i = 0; i < o.len; i++)
+		free(o.names[i].ptr);
+	free(o.names);
+}
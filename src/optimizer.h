@@ -0,0 +1,13 @@
+/// Describes the optimizer, which simplifies a parsed AST before it's ran
+
+#ifndef W_OPTIMIZER_H
+#define W_OPTIMIZER_H
+
+#include "parser.h"
+
+/// Folds calls to pure builtins whose arguments are all literals into literals (or constant lists), and drops if branches whose
+/// conditions are literals. Builtins are only folded if no variable in the program has their name, since they could be rebound
+/// otherwise. The AST is resolved again afterwards.
+void w_optimize(w_ast_t *ast);
+
+#endif
@@ -3,24 +3,52 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "parser.h"
+#include "compiler.h"
+#include "resolver.h"
+#include "interpreter.h"
+
+static void source_release(w_source_t *source) {
+	if(--source->refcount != 0)
+		return;
+	free(source->code);
+	free(source);
+}
 
 static void commands_free(w_ast_commands_t *cmds) {
 	for(size_t i = 0; i < cmds->len; i++) {
 		for(size_t j = 0; j < cmds->ptr[i].len; j++)
 			w_ast_free(&cmds->ptr[i].ptr[j]);
 		free(cmds->ptr[i].ptr);
+		free(cmds->ptr[i].ic);
 	}
 	free(cmds->ptr);
 }
 
 void w_ast_free(w_ast_t *ast) {
+	w_ast_unquicken(ast);
 	switch(ast->type) {
 		case W_AST_STRING:
 		case W_AST_VAR:
 			free(ast->string.ptr);
 			break;
+		case W_AST_CONST:
+			w_value_release(ast->value);
+			free(ast->value);
+			break;
 		case W_AST_COMMANDS: {
+			if(ast->commands.source != NULL)
+				source_release(ast->commands.source);
 			commands_free(&ast->commands);
+			if(ast->commands.chunk != NULL)
+				w_chunk_free(ast->commands.chunk);
+			w_layout_t *layout = ast->commands.layout;
+			if(layout != NULL) {
+				for(size_t i = 0; i < layout->len; i++)
+					free(layout->names[i].ptr);
+				free(layout->names);
+				free(layout->syms);
+				free(layout);
+			}
 			break;
 		}
 		case W_AST_INDEX: {
@@ -34,38 +62,116 @@ void w_ast_free(w_ast_t *ast) {
 	}
 }
 
-w_ast_t w_ast_dup(w_ast_t *ast) {
+/// Maps the layouts of the tree being duplicated to the layouts of the new tree
+typedef struct dup_map {
+	w_layout_t *old, *new;
+	struct dup_map *next;
+} dup_map_t;
+
+// layouts outside of the duplicated tree are mapped to NULL
+static w_layout_t *dup_layout(dup_map_t *map, w_layout_t *layout) {
+	for(; map != NULL; map = map->next)
+		if(map->old == layout)
+			return map->new;
+	return NULL;
+}
+
+// slots referring to layouts outside of the duplicated tree are left unresolved
+static w_ast_slot_t dup_slot(dup_map_t *map, w_ast_slot_t slot) {
+	w_layout_t *layout = dup_layout(map, slot.layout);
+	if(layout == NULL)
+		return (w_ast_slot_t){NULL, 0, 0};
+	return (w_ast_slot_t){layout, slot.depth, slot.index};
+}
+
+static w_ast_t ast_dup(dup_map_t *map, w_ast_t *ast) {
 	switch(ast->type) {
 		case W_AST_FLOAT:
 		case W_AST_INT:
+		case W_AST_NULL:
 			return *ast;
+		case W_AST_CONST: {
+			w_value_t *value = malloc(sizeof(w_value_t));
+			*value = *ast->value;
+			w_value_ref(value);
+			return (w_ast_t){.type = W_AST_CONST, .pos = ast->pos, .value = value};
+		}
 		case W_AST_STRING:
-			return (w_ast_t){.type = W_AST_STRING, .pos = ast->pos, .string = w_astrdup(&ast->string)};
+			return (w_ast_t){.type = W_AST_STRING, .member = ast->member, .pos = ast->pos, .string = w_astrdup(&ast->string), .slot = dup_slot(map, ast->slot)};
 		case W_AST_VAR:
-			return (w_ast_t){.type = W_AST_VAR, .pos = ast->pos, .string = w_astrdup(&ast->string)};
+			return (w_ast_t){.type = W_AST_VAR, .pos = ast->pos, .string = w_astrdup(&ast->string), .slot = dup_slot(map, ast->slot)};
 		case W_AST_COMMANDS: {
 			w_ast_commands_t *old = &ast->commands;
+			w_layout_t *layout = NULL;
+			if(old->layout != NULL) {
+				layout = malloc(sizeof(w_layout_t));
+				*layout = *old->layout;
+				layout->names = malloc(sizeof(w_astring_t)*layout->len);
+				layout->syms = malloc(sizeof(w_sym_t *)*layout->len);
+				memcpy(layout->syms, old->layout->syms, sizeof(w_sym_t *)*layout->len);
+				layout->parent = dup_layout(map, old->layout->parent);
+				for(size_t i = 0; i < layout->len; i++)
+					layout->names[i] = w_astrdup(&old->layout->names[i]);
+			}
+			dup_map_t sub = (dup_map_t){old->layout, layout, map};
 			w_ast_command_t *cmds = malloc(sizeof(w_ast_command_t)*old->len);
 			for(size_t i = 0; i < old->len; i++) {
 				w_ast_command_t *oldcmd = &old->ptr[i];
 				w_ast_t *cmd = malloc(sizeof(w_ast_t)*oldcmd->len);
 				for(size_t i = 0; i < oldcmd->len; i++)
-					cmd[i] = w_ast_dup(&oldcmd->ptr[i]);
+					cmd[i] = ast_dup(&sub, &oldcmd->ptr[i]);
 				cmds[i] = (w_ast_command_t){oldcmd->len, cmd};
 			}
-			return (w_ast_t){.type = W_AST_COMMANDS, .pos = ast->pos, .commands = (w_ast_commands_t){old->len, cmds}};
+			if(old->source != NULL)
+				old->source->refcount++;
+			return (w_ast_t){.type = W_AST_COMMANDS, .pos = ast->pos, .commands = (w_ast_commands_t){old->len, cmds, NULL, layout, old->native, NULL, old->source, old->start}};
 		}
 		case W_AST_INDEX: {
 			w_ast_index_t *idx = &ast->index;
 			w_ast_t *left = malloc(sizeof(w_ast_t));
 			w_ast_t *right = malloc(sizeof(w_ast_t));
-			*left = w_ast_dup(idx->left);
-			*right = w_ast_dup(idx->right);
+			*left = ast_dup(map, idx->left);
+			*right = ast_dup(map, idx->right);
 			return (w_ast_t){.type = W_AST_INDEX, .pos = ast->pos, .index = (w_ast_index_t){left, right}};
 		}
 	}
 }
 
+w_ast_t w_ast_dup(w_ast_t *ast) {
+	return ast_dup(NULL, ast);
+}
+
+static void mark_tree(w_ast_t *ast, w_tree_t *tree) {
+	switch(ast->type) {
+		case W_AST_COMMANDS:
+			ast->commands.tree = tree;
+			for(size_t i = 0; i < ast->commands.len; i++)
+				for(size_t j = 0; j < ast->commands.ptr[i].len; j++)
+					mark_tree(&ast->commands.ptr[i].ptr[j], tree);
+			break;
+		case W_AST_INDEX:
+			mark_tree(ast->index.left, tree);
+			mark_tree(ast->index.right, tree);
+			break;
+		default:
+			break;
+	}
+}
+
+w_tree_t *w_tree_new(w_ast_t ast) {
+	w_tree_t *tree = malloc(sizeof(w_tree_t));
+	*tree = (w_tree_t){1, ast};
+	mark_tree(&tree->ast, tree);
+	return tree;
+}
+
+void w_tree_release(w_tree_t *tree) {
+	if(--tree->refcount != 0)
+		return;
+	w_ast_free(&tree->ast);
+	free(tree);
+}
+
 void w_ast_print(w_ast_t *ast) {
 	switch(ast->type) {
 		case W_AST_STRING: {
@@ -108,6 +214,9 @@ void w_ast_print(w_ast_t *ast) {
 		case W_AST_NULL:
 			printf("null");
 			break;
+		case W_AST_CONST:
+			w_value_print(ast->value, stdout);
+			break;
 		case W_AST_COMMANDS: {
 			printf("[");
 			w_ast_commands_t *cmds = &ast->commands;
@@ -138,6 +247,9 @@ typedef struct parser {
 	char *filename, *code;
 	size_t pos, len, start; // len is just the cached strlen() of code
 	w_status_t *status;
+	bool lazy; // whether cmd bodies are left for their first call
+	w_source_t *source; // copy of the code for those bodies, NULL until there's one
+	bool cmd_var; // whether a variable named cmd was seen, which could make a body run some other way
 } parser_t;
 
 /// Get current position
@@ -176,12 +288,15 @@ static void add(parser_t *p, w_ast_commands_t *cmds) {
 		// var
 		len--;
 		start++;
+		if(len == 3 && memcmp(start, "cmd", 3) == 0)
+			p->cmd_var = true;
 		str = malloc(len);
 		memcpy(str, start, len);
 		ast = (w_ast_t){
 			.type = W_AST_VAR,
 			.string = (w_astring_t){len, str}
 		};
+		w_hash(&ast.string); // names and keys are hashed once here instead of on every lookup
 	}
 	else if(w_is_int(start, len)) {
 		int64_t n = w_parse_int(start, len);
@@ -208,6 +323,7 @@ static void add(parser_t *p, w_ast_commands_t *cmds) {
 			.type = W_AST_STRING,
 			.string = (w_astring_t){len, str}
 		};
+		w_hash(&ast.string);
 	}
 	ast.pos = get_pos(p);
 	ADD_AST(cmds, ast);
@@ -236,6 +352,8 @@ static void resolve_index(parser_t *p, w_ast_commands_t *cmds) {
 						w_ast_t *right = malloc(sizeof(w_ast_t));
 						*left = cmd->ptr[j-1];
 						*right = cmd->ptr[j+1];
+						if(right->type == W_AST_STRING)
+							right->member = w_member_find(&right->string);
 						// shorten length by 2
 						memmove(&cmd->ptr[j-1], &cmd->ptr[j+1], sizeof(w_ast_t)*(cmd->len-j-1));
 						cmd->ptr = realloc(cmd->ptr, sizeof(w_ast_t)*(cmd->len-2));
@@ -264,6 +382,114 @@ static void resolve_index(parser_t *p, w_ast_commands_t *cmds) {
 	}
 }
 
+/// Variable names found while skipping a block
+typedef struct vars {
+	size_t len, cap;
+	w_astring_t *ptr;
+} vars_t;
+
+// whether a character ends a token
+static bool delimiter(char c) {
+	switch(c) {
+		case ' ':
+		case '\r':
+		case '\n':
+		case '\t':
+		case '[':
+		case ']':
+		case ';':
+		case '$':
+		case '#':
+		case ':':
+		case '"':
+			return true;
+		default:
+			return false;
+	}
+}
+
+// moves *pos from the start of a block's contents to its closing ']', going over strings and comments the same way the parser does.
+// cmd_var is set if a variable named cmd is used inside, and names of variables are added to vars unless it's NULL. returns false if
+// the block isn't closed.
+static bool skip_block(char *code, size_t len, size_t *pos, bool *cmd_var, vars_t *vars) {
+	size_t depth = 1;
+	for(size_t i = *pos; i < len; i++) {
+		switch(code[i]) {
+			case '[':
+				depth++;
+				break;
+			case ']':
+				if(--depth == 0) {
+					*pos = i;
+					return true;
+				}
+				break;
+			case '#':
+				while(code[i] != '\n' && i < len)
+					i++;
+				break;
+			case '"':
+				for(i++; i < len && code[i] != '"'; i++)
+					if(code[i] == '\\')
+						i++;
+				if(i >= len)
+					return false;
+				break;
+			case '$': {
+				size_t start = ++i;
+				while(i < len && !delimiter(code[i]))
+					i++;
+				w_astring_t name = (w_astring_t){i-start, &code[start]};
+				if(w_astreqc(&name, "cmd"))
+					*cmd_var = true;
+				if(vars != NULL) {
+					if(vars->len >= vars->cap) {
+						vars->cap = vars->cap == 0 ? 16 : vars->cap*2;
+						vars->ptr = realloc(vars->ptr, sizeof(w_astring_t)*vars->cap);
+					}
+					vars->ptr[vars->len++] = name;
+				}
+				i--; // the delimiter is looked at next
+				break;
+			}
+		}
+	}
+	return false;
+}
+
+// leaves a block for its first call if it's the body of a literal cmd call, like the resolver would treat it. p is right after the
+// block's '[', and is moved to its ']' if the block is left.
+static bool lazy_block(parser_t *p, w_ast_command_t *cmd, w_ast_t *out) {
+	if(!p->lazy || cmd->len == 0 || cmd->ptr[0].type != W_AST_STRING || !w_astreqc(&cmd->ptr[0].string, "cmd"))
+		return false;
+	for(size_t i = 1; i < cmd->len; i++)
+		if(cmd->ptr[i].type != W_AST_VAR)
+			return false;
+	// unclosed blocks are parsed normally, which gives the error
+	size_t end = p->pos;
+	if(!skip_block(p->code, p->len, &end, &p->cmd_var, NULL))
+		return false;
+	// anything after the block would make it something other than the body
+	size_t next = end+1;
+	while(next < p->len && (p->code[next] == ' ' || p->code[next] == '\t' || p->code[next] == '\r' || p->code[next] == '\n'))
+		next++;
+	if(next < p->len && p->code[next] != ';' && p->code[next] != ']')
+		return false;
+	if(p->source == NULL) {
+		p->source = malloc(sizeof(w_source_t));
+		*p->source = (w_source_t){1, p->filename, malloc(p->len+1), p->len};
+		memcpy(p->source->code, p->code, p->len+1);
+	}
+	p->source->refcount++;
+	*out = (w_ast_t){
+		.type = W_AST_COMMANDS,
+		.pos = get_pos(p),
+		.commands = (w_ast_commands_t){.source = p->source, .start = p->pos}
+	};
+	p->pos = end;
+	return true;
+}
+
 /// Actual implementation of the parser
 static w_ast_t parse(bool top_level, parser_t *p) {
 	w_filepos_t cmd_pos = get_pos(p);
@@ -316,10 +542,13 @@ static w_ast_t parse(bool top_level, parser_t *p) {
 				add(p, &cmds);
 				p->pos++;
 				p->start = p->pos;
-				w_ast_t ast = parse(false, p);
-				if(p->status->tag != W_STATUS_OK) {
-					commands_free(&cmds);
-					return (w_ast_t){};
+				w_ast_t ast;
+				if(!lazy_block(p, &cmds.ptr[cmds.len-1], &ast)) {
+					ast = parse(false, p);
+					if(p->status->tag != W_STATUS_OK) {
+						commands_free(&cmds);
+						return (w_ast_t){};
+					}
 				}
 				w_ast_command_t *cmd = &cmds.ptr[cmds.len-1];
 				cmd->ptr = realloc(cmd->ptr, sizeof(w_ast_t)*(++cmd->len));
@@ -423,6 +652,7 @@ static w_ast_t parse(bool top_level, parser_t *p) {
 					.type = W_AST_STRING,
 					.string = (w_astring_t){len, str}
 				};
+				w_hash(&ast.string);
 				ADD_AST(&cmds, ast);
 				p->start = p->pos+1;
 			}
@@ -437,18 +667,56 @@ static w_ast_t parse(bool top_level, parser_t *p) {
 #undef ADD_AST
 
 w_ast_t w_parse(w_status_t *status, char *filename, char *code) {
-	parser_t parser = (parser_t){filename, code, 0, strlen(code), 0, status};
-	return parse(true, &parser);
+	parser_t parser = (parser_t){filename, code, 0, strlen(code), 0, status, w_options.lazy, NULL, false};
+	w_ast_t ast = parse(true, &parser);
+	w_source_t *source = parser.source;
+	// a variable named cmd could pass a body that hasn't been parsed to something other than the builtin, and a syntax error could be in
+	// one of the bodies that were skipped, so in both cases the file is parsed again without leaving anything for later
+	if(source != NULL && (parser.cmd_var || status->tag != W_STATUS_OK)) {
+		if(status->tag == W_STATUS_OK)
+			w_ast_free(&ast);
+		w_status_ok(status);
+		parser = (parser_t){filename, code, 0, parser.len, 0, status, false, NULL, false};
+		ast = parse(true, &parser);
+	}
+	if(source != NULL)
+		source_release(source);
+	if(status->tag == W_STATUS_OK)
+		w_resolve(&ast);
+	return ast;
+}
+
+bool w_ast_force(w_status_t *status, w_ast_t *ast, size_t argc, w_ast_t *argv) {
+	w_ast_commands_t *cmds = &ast->commands;
+	w_source_t *source = cmds->source;
+	parser_t parser = (parser_t){source->filename, source->code, cmds->start, source->len, cmds->start, status, true, source, false};
+	w_ast_t body = parse(false, &parser);
+	if(status->tag != W_STATUS_OK)
+		return false;
+	w_resolve_body(&body, argc, argv);
+	mark_tree(&body, cmds->tree);
+	source_release(source);
+	*ast = body;
+	return true;
+}
+
+w_astring_t *w_ast_lazy_vars(w_ast_t *ast, size_t *len) {
+	size_t pos = ast->commands.start;
+	bool cmd_var;
+	vars_t vars = (vars_t){0, 0, NULL};
+	skip_block(ast->commands.source->code, ast->commands.source->len, &pos, &cmd_var, &vars);
+	*len = vars.len;
+	return vars.ptr;
 }
 
 w_astring_t w_astrdup(w_astring_t *str) {
 	char *buf = malloc(str->len);
 	memcpy(buf, str->ptr, str->len);
-	return (w_astring_t){str->len, buf};
+	return (w_astring_t){str->len, buf, str->hash};
 }
 
 bool w_astreq(w_astring_t *a, w_astring_t *b) {
-	if(a->len != b->len)
+	if(a->len != b->len || (a->hash != 0 && b->hash != 0 && a->hash != b->hash))
 		return false;
 	for(size_t i = 0; i < a->len; i++)
 		if(a->ptr[i] != b->ptr[i])
@@ -12,6 +12,7 @@
 typedef enum w_ast_type {
 	// literals
 	W_AST_STRING, W_AST_VAR, W_AST_INT, W_AST_FLOAT, W_AST_NULL,
+	W_AST_CONST, // a constant value made by the optimizer
 	// constructs
 	W_AST_COMMANDS, W_AST_INDEX
 } w_ast_type_t;
@@ -20,20 +21,54 @@ typedef enum w_ast_type {
 typedef struct w_astring {
 	size_t len;
 	char *ptr;
+	size_t hash; /// w_hash of the string once it's been computed, 0 before then. must be reset if the string is changed.
 } w_astring_t;
 
+typedef struct w_layout w_layout_t;
+typedef struct w_sym w_sym_t;
+
+/// Static layout of a scope's variables, filled in by the resolver
+struct w_layout {
+	size_t len; /// Number of slots. Blocks with no slots don't get a frame at all.
+	w_astring_t *names; /// Name of each slot
+	w_sym_t **syms; /// Interned name of each slot
+	size_t argc; /// Number of leading slots that hold command arguments. These act as if they were declared in an enclosing scope.
+	uint64_t bloom; /// Bloom filter of the names (see w_bloom())
+	w_layout_t *parent; /// Layout of the enclosing block in the same command body, NULL at the top
+};
+
+/// Resolved address of a variable. Set by the resolver on W_AST_VAR nodes and command names.
+typedef struct w_ast_slot {
+	w_layout_t *layout; /// Layout of the scope the variable is declared in, NULL if it couldn't be resolved
+	uint32_t depth; /// Amount of frames to go up from the current one. Blocks without slots don't count, since they don't have a frame.
+	uint32_t index; /// Index of the slot in the frame
+} w_ast_slot_t;
+
 typedef struct w_ast w_ast_t;
+typedef struct w_chunk w_chunk_t;
+typedef struct w_ic w_ic_t;
+typedef struct w_native w_native_t;
+typedef struct w_tree w_tree_t;
+typedef struct w_source w_source_t;
+typedef struct w_value w_value_t;
 
 /// Represents a single command
 typedef struct w_ast_command {
 	size_t len;
 	w_ast_t *ptr;
+	w_ic_t *ic; /// Cache of the command the name last resolved to. NULL until the command is first ran.
 } w_ast_command_t;
 
 /// Command block in the AST
 typedef struct w_ast_commands {
 	size_t len;
 	w_ast_command_t *ptr;
+	w_chunk_t *chunk; /// Compiled bytecode for this block. NULL until it is first ran on the VM.
+	w_layout_t *layout; /// Variables declared directly in this block. NULL if the block hasn't been resolved.
+	w_native_t *native; /// Code generated ahead of time for this block by --emit-c, NULL otherwise
+	w_tree_t *tree; /// Tree the block is part of, which commands made from the block keep alive. NULL for blocks that are never freed.
+	w_source_t *source; /// Code of a block that's parsed on its first call (see w_ast_force), NULL once it's been parsed
+	size_t start; /// Offset of the block's contents in source, right after its '['
 } w_ast_commands_t;
 
 /// Dot expr in the AST
@@ -44,21 +79,52 @@ typedef struct w_ast_index {
 /// Tagged union for an AST
 typedef struct w_ast {
 	w_ast_type_t type; /// AST type
+	uint8_t quick; /// Specialized form the node has rewritten itself to while running (a w_quick_t), 0 if it hasn't
+	uint8_t hits; /// Executions counted towards specializing
+	uint8_t member; /// Builtin member a string on the right of an index names (a w_member_t), 0 if it doesn't name one
+	bool last; /// Set on a variable while a set! evaluates a value that reads it for the last time before overwriting it, as in set! $l [$l:push 1]
 	w_filepos_t pos; /// Position of node
+	void *cache; /// Data of the specialized form
 	/// Union of data for all types
 	union {
-		w_astring_t string; // for both string and var
+		// for both string and var
+		struct {
+			w_astring_t string;
+			w_ast_slot_t slot; // only used for vars and command names
+		};
 		int64_t int_;
 		double float_;
+		w_value_t *value; // a list of ints, floats and nulls. each evaluation gets a copy of it.
 		w_ast_commands_t commands;
 		w_ast_index_t index;
 	};
 } w_ast_t;
 
+/// Copy of the code a file was parsed from, kept for the blocks that haven't been parsed yet
+struct w_source {
+	w_refcount_t refcount; /// Reference count, one for each of those blocks
+	char *filename; /// Name of the file, which isn't owned, like in the file positions of the AST
+	char *code; /// Code of the whole file, so that positions in it come out the same as in an eager parse
+	size_t len; /// Length of the code
+};
+
+/// A parsed program, shared by the commands made from its blocks instead of them each getting a copy
+struct w_tree {
+	w_refcount_t refcount; /// Reference count
+	w_ast_t ast; /// Root of the tree
+};
+
 void w_ast_free(w_ast_t *ast); /// Frees an AST
+w_tree_t *w_tree_new(w_ast_t ast); /// Takes ownership of an AST that's ready to run, marking every block in it as part of the returned tree
+void w_tree_release(w_tree_t *tree); /// Releases a reference to a tree, freeing it once there are none left
 void w_ast_print(w_ast_t *ast); /// Prints an AST
 w_ast_t w_ast_dup(w_ast_t *ast); /// Duplicates an AST
 w_ast_t w_parse(w_status_t *status, char *filename, char *code); /// Parses a file and returns an AST. 
+/// Parses a block that was left for its first call in place, resolving it as the body of a command with the arguments argv (var nodes).
+/// Returns false and leaves the block as it was if it has a syntax error, which is at the same position as in an eager parse.
+bool w_ast_force(w_status_t *status, w_ast_t *ast, size_t argc, w_ast_t *argv);
+/// Lists the names of the variables used in a block that hasn't been parsed yet, pointing into its source. The array has to be freed.
+w_astring_t *w_ast_lazy_vars(w_ast_t *ast, size_t *len);
 w_astring_t w_astrdup(w_astring_t *str); /// Duplicates an AST string
 bool w_astreq(w_astring_t *a, w_astring_t *b); /// Test if two ast strings are equal
 bool w_astreqc(w_astring_t *a, char *b); /// Test if an AST string and a C string are equal
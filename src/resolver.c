@@ -0,0 +1,189 @@
+#include <stdlib.h>
+
+#include "resolver.h"
+#include "hashtable.h"
+
+/// A resolved reference, whose depth is only known once every layout is complete
+typedef struct ref {
+	w_ast_t *var;
+	w_layout_t *from; // layout of the block the reference is in
+} ref_t;
+
+/// Resolver state. Scopes are only tracked within a single command body, since commands are dynamically scoped.
+typedef struct resolver {
+	size_t len, cap;
+	w_layout_t **scopes; // layouts of the enclosing blocks, innermost last
+	size_t refs_len, refs_cap;
+	ref_t *refs;
+} resolver_t;
+
+static void resolve_expr(resolver_t *r, w_ast_t *ast);
+
+// declares a variable in the innermost scope
+static void declare(resolver_t *r, w_ast_t *var) {
+	w_layout_t *layout = r->scopes[r->len-1];
+	layout->names = realloc(layout->names, sizeof(w_astring_t)*(layout->len+1));
+	layout->names[layout->len] = w_astrdup(&var->string);
+	layout->syms = realloc(layout->syms, sizeof(w_sym_t *)*(layout->len+1));
+	layout->syms[layout->len] = w_intern(&var->string);
+	layout->bloom |= w_bloom(&var->string);
+	var->slot = (w_ast_slot_t){layout, 0, layout->len++};
+}
+
+// resolves a reference to a variable
+static void reference(resolver_t *r, w_ast_t *var) {
+	for(size_t i = r->len; i > 0; i--) {
+		w_layout_t *layout = r->scopes[i-1];
+		// search backwards, since a name can be declared again after being deleted
+		for(size_t j = layout->len; j > 0; j--) {
+			if(w_astreq(&layout->names[j-1], &var->string)) {
+				var->slot = (w_ast_slot_t){layout, 0, j-1};
+				if(r->refs_len >= r->refs_cap) {
+					r->refs_cap = r->refs_cap == 0 ? 16 : r->refs_cap*2;
+					r->refs = realloc(r->refs, sizeof(ref_t)*r->refs_cap);
+				}
+				r->refs[r->refs_len++] = (ref_t){var, r->scopes[r->len-1]};
+				return;
+			}
+		}
+	}
+	var->slot = (w_ast_slot_t){NULL, 0, 0};
+}
+
+static void resolve_command(resolver_t *r, w_ast_command_t *cmd);
+
+// resolves a block, with the given variables declared at the start of it (cmd arguments or for variables)
+static void resolve_block(resolver_t *r, w_ast_t *ast, size_t argc, w_ast_t *argv) {
+	w_ast_commands_t *cmds = &ast->commands;
+	if(cmds->layout == NULL) {
+		cmds->layout = malloc(sizeof(w_layout_t));
+		*cmds->layout = (w_layout_t){0, NULL, NULL, 0, 0, r->len == 0 ? NULL : r->scopes[r->len-1]};
+	}
+	if(r->len >= r->cap) {
+		r->cap = r->cap == 0 ? 8 : r->cap*2;
+		r->scopes = realloc(r->scopes, sizeof(w_layout_t *)*r->cap);
+	}
+	r->scopes[r->len++] = cmds->layout;
+	for(size_t i = 0; i < argc; i++)
+		declare(r, &argv[i]);
+	for(size_t i = 0; i < cmds->len; i++)
+		resolve_command(r, &cmds->ptr[i]);
+	r->len--;
+}
+
+void w_resolve_body(w_ast_t *body, size_t argc, w_ast_t *argv) {
+	// bodies that haven't been parsed yet are resolved once they are
+	if(body->type == W_AST_COMMANDS && body->commands.source != NULL)
+		return;
+	resolver_t r = (resolver_t){0, 0, NULL, 0, 0, NULL};
+	if(body->type == W_AST_COMMANDS) {
+		resolve_block(&r, body, argc, argv);
+		body->commands.layout->argc = argc;
+	}
+	else
+		resolve_expr(&r, body);
+	// blocks that ended up without slots get no frame, so they're skipped when counting the depth
+	for(size_t i = 0; i < r.refs_len; i++) {
+		w_ast_slot_t *slot = &r.refs[i].var->slot;
+		for(w_layout_t *l = r.refs[i].from; l != slot->layout; l = l->parent)
+			if(l->len > 0)
+				slot->depth++;
+	}
+	free(r.scopes);
+	free(r.refs);
+}
+
+static bool all_vars(size_t len, w_ast_t *ptr) {
+	for(size_t i = 0; i < len; i++)
+		if(ptr[i].type != W_AST_VAR)
+			return false;
+	return true;
+}
+
+static void resolve_command(resolver_t *r, w_ast_command_t *cmd) {
+	w_ast_t *name = &cmd->ptr[0];
+	size_t argc = cmd->len-1;
+	w_ast_t *args = cmd->ptr+1;
+	if(name->type != W_AST_STRING) {
+		resolve_expr(r, name);
+		for(size_t i = 0; i < argc; i++)
+			resolve_expr(r, &args[i]);
+		return;
+	}
+	reference(r, name);
+	if(w_astreqc(&name->string, "let!") && argc%2 == 0) {
+		// each value is evaluated before its variable is declared
+		for(size_t i = 0; i < argc; i += 2) {
+			resolve_expr(r, &args[i+1]);
+			if(args[i].type == W_AST_VAR)
+				declare(r, &args[i]);
+		}
+		return;
+	}
+	if(w_astreqc(&name->string, "cmd") && argc >= 1 && all_vars(argc-1, args)) {
+		w_resolve_body(&args[argc-1], argc-1, args);
+		return;
+	}
+	if(w_astreqc(&name->string, "for") && argc >= 2 && argc <= 4 && all_vars(argc-2, args)) {
+		resolve_expr(r, &args[argc-2]);
+		w_ast_t *body = &args[argc-1];
+		if(body->type == W_AST_COMMANDS)
+			resolve_block(r, body, argc-2, args);
+		else
+			resolve_expr(r, body);
+		return;
+	}
+	for(size_t i = 0; i < argc; i++)
+		resolve_expr(r, &args[i]);
+}
+
+static void resolve_expr(resolver_t *r, w_ast_t *ast) {
+	switch(ast->type) {
+		case W_AST_VAR:
+			if(!w_astreqc(&ast->string, "this"))
+				reference(r, ast);
+			break;
+		case W_AST_INDEX:
+			resolve_expr(r, ast->index.left);
+			resolve_expr(r, ast->index.right);
+			break;
+		case W_AST_COMMANDS:
+			resolve_block(r, ast, 0, NULL);
+			break;
+	}
+}
+
+void w_resolve(w_ast_t *ast) {
+	w_resolve_body(ast, 0, NULL);
+}
+
+void w_unresolve(w_ast_t *ast) {
+	switch(ast->type) {
+		case W_AST_STRING:
+		case W_AST_VAR:
+			ast->slot = (w_ast_slot_t){NULL, 0, 0};
+			break;
+		case W_AST_INDEX:
+			w_unresolve(ast->index.left);
+			w_unresolve(ast->index.right);
+			break;
+		case W_AST_COMMANDS: {
+			w_ast_commands_t *cmds = &ast->commands;
+			for(size_t i = 0; i < cmds->len; i++)
+				for(size_t j = 0; j < cmds->ptr[i].len; j++)
+					w_unresolve(&cmds->ptr[i].ptr[j]);
+			w_layout_t *layout = cmds->layout;
+			if(layout != NULL) {
+				for(size_t i = 0; i < layout->len; i++)
+					free(layout->names[i].ptr);
+				free(layout->names);
+				free(layout->syms);
+				free(layout);
+				cmds->layout = NULL;
+			}
+			break;
+		}
+		default:
+			break;
+	}
+}
@@ -0,0 +1,17 @@
+/// Describes the resolver, which assigns variables to slots in their scope's frame
+
+#ifndef W_RESOLVER_H
+#define W_RESOLVER_H
+
+#include "parser.h"
+
+/// Resolves all variables declared with let!, cmd and for in a parsed AST, filling in the layout of every block and the slot of every
+/// variable reference that refers to one of them. References that can't be resolved (globals, variables from the calling command, names
+/// declared at runtime) are left with a NULL layout and are looked up by name.
+void w_resolve(w_ast_t *ast);
+/// Resolves a command body, which starts a new set of scopes, with its arguments argv declared at the start of it
+void w_resolve_body(w_ast_t *body, size_t argc, w_ast_t *argv);
+/// Undoes w_resolve, so that an AST can be rewritten and then resolved again
+void w_unresolve(w_ast_t *ast);
+
+#endif
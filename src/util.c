@@ -17,15 +17,24 @@
 #include "util.h"
 
 w_error_t *w_error_new(w_filepos_t pos, char *fmt, ...) {
-	char *msg = malloc(W_MAX_ERROR_LEN);
+	// most messages are constant, and don't need to be formatted at all
+	if(strchr(fmt, '%') == NULL) {
+		w_error_t *e = malloc(sizeof(w_error_t));
+		*e = (w_error_t){pos, fmt};
+		return e;
+	}
 
-	va_list ap;
+	va_list ap, ap2;
 	va_start(ap, fmt);
-	vsnprintf(msg, W_MAX_ERROR_LEN, fmt, ap);
+	va_copy(ap2, ap);
+	int len = vsnprintf(NULL, 0, fmt, ap);
 	va_end(ap);
-	
-	w_error_t *e = malloc(sizeof(w_error_t));
-	*e = (w_error_t){pos, msg};
+
+	// the message goes in the same allocation as the error
+	w_error_t *e = malloc(sizeof(w_error_t)+len+1);
+	*e = (w_error_t){pos, (char *)(e+1)};
+	vsnprintf(e->msg, len+1, fmt, ap2);
+	va_end(ap2);
 	return e;
 }
 
@@ -34,7 +43,6 @@ void w_error_print(w_error_t *err, FILE *fp) {
 }
 
 void w_error_free(w_error_t *err) {
-	free(err->msg);
 	free(err);
 }
 
@@ -49,8 +57,7 @@ void w_status_free(w_status_t *s) {
 			w_error_free(s->err);
 			break;
 		case W_STATUS_RETURN:
-			w_value_release(s->ret);
-			free(s->ret);
+			w_value_release((w_value_t *)s->ret);
 			break;
 	}
 }
@@ -68,15 +75,11 @@ void w_status_err(w_status_t *s, w_error_t *err) {
 
 void w_hack_set_value(w_value_t *a, w_value_t *b); // does *a = *b
 																									 // here to bypass C #include hell
-w_value_t *w_hack_malloc_value(void);
 
 void w_status_return(w_status_t *s, w_value_t *val) {
 	w_status_free(s);
-	w_value_t *pv = w_hack_malloc_value();
-	w_hack_set_value(pv, val);
-	w_value_ref(pv);
+	w_hack_set_value((w_value_t *)s->ret, val);
 	s->tag = W_STATUS_RETURN;
-	s->ret = pv;
 }
 
 #if __GLIBC__
@@ -8,22 +8,21 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+typedef uint32_t w_refcount_t;
+
 /// Represents a position in a file
 typedef struct w_filepos {
 	char *filename;
 	size_t line, col;
 } w_filepos_t;
 
-/// Maximum length of an error's msg
-#define W_MAX_ERROR_LEN 4096
-
 /// Represents an error
 typedef struct w_error {
 	w_filepos_t pos; /// File position the error occurred at
-	char *msg; /// Message of the error
+	char *msg; /// Message of the error. Either the format string itself, if it has no conversions, or stored right after the error
 } w_error_t;
 
-w_error_t *w_error_new(w_filepos_t pos, char *fmt, ...); /// Creates an error, uses printf formatting for args
+w_error_t *w_error_new(w_filepos_t pos, char *fmt, ...); /// Creates an error, uses printf formatting for args. fmt must outlive the error
 void w_error_print(w_error_t *err, FILE *fp);
 void w_error_free(w_error_t *err); /// Frees an error
 
@@ -43,7 +42,7 @@ typedef struct w_status {
 	w_status_tag_t tag; /// Tag of the status
 	union {
 		w_error_t *err; /// Error
-		w_value_t *ret; /// Return value
+		uint64_t ret[2]; /// Return value, kept inline so returning doesn't allocate. w_value_t isn't complete here, so get at it with w_status_ret
 	};
 } w_status_t;
 
@@ -57,7 +56,7 @@ void w_status_simple(w_status_t *s, w_status_tag_t tag);
 #define w_status_break(s) w_status_simple(s, W_STATUS_BREAK)
 #define w_status_continue(s) w_status_simple(s, W_STATUS_CONTINUE)
 void w_status_err(w_status_t *s, w_error_t *err); // sets a status to err
-void w_status_return(w_status_t *s, w_value_t *val); // returns a value
+void w_status_return(w_status_t *s, w_value_t *val); // returns a value, taking ownership of it
 
 // when creating a status, set it to this.
 #define W_INITIAL_STATUS (w_status_t){.tag = W_STATUS_OK}
@@ -0,0 +1,502 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm.h"
+#include "jit.h"
+#include "commands.h"
+
+#define PUSH(V) (vm->stack[vm->sp++] = (V))
+#define CHECK if(vm->status->tag != W_STATUS_OK) return W_VM_UNWIND
+#define OP_FN(NAME) static w_vm_result_t NAME(w_vm_t *vm, w_insn_t *insn)
+
+OP_FN(op_null) {
+	PUSH(((w_value_t){.type = W_VALUE_NULL}));
+	return W_VM_NEXT;
+}
+
+OP_FN(op_int) {
+	PUSH(((w_value_t){.type = W_VALUE_INT, .int_ = insn->int_}));
+	return W_VM_NEXT;
+}
+
+OP_FN(op_float) {
+	PUSH(((w_value_t){.type = W_VALUE_FLOAT, .float_ = insn->float_}));
+	return W_VM_NEXT;
+}
+
+OP_FN(op_string) {
+	PUSH(w_eval_string(insn->ast));
+	return W_VM_NEXT;
+}
+
+OP_FN(op_const) {
+	PUSH(w_value_clone(insn->ast->value));
+	return W_VM_NEXT;
+}
+
+OP_FN(op_var) {
+	w_value_t *v = w_ctx_get_var(vm->cur, insn->ast);
+	if(v == NULL) {
+		char *name = w_ast_cstr(&insn->ast->string);
+		w_status_err(vm->status, w_error_new(insn->ast->pos, "Unbound string %s.", name));
+		free(name);
+		return W_VM_UNWIND;
+	}
+	w_value_ref(v);
+	PUSH(*v);
+	return W_VM_NEXT;
+}
+
+OP_FN(op_this) {
+	if(vm->this == NULL)
+		PUSH(((w_value_t){.type = W_VALUE_NULL}));
+	else {
+		w_value_ref(vm->this);
+		PUSH(*vm->this);
+	}
+	return W_VM_NEXT;
+}
+
+OP_FN(op_index) {
+	w_value_t *left = &vm->stack[vm->sp-2], *right = &vm->stack[vm->sp-1];
+	w_value_t ret = w_eval_index(vm->cur, insn->ast, left, right);
+	w_value_release(left);
+	w_value_release(right);
+	vm->sp -= 2;
+	CHECK;
+	PUSH(ret);
+	return W_VM_NEXT;
+}
+
+OP_FN(op_index_borrow) {
+	w_ast_t *ast = insn->ast;
+	w_value_t left, right;
+	bool own_left = w_eval_borrowed(vm->cur, ast->index.left, vm->this, &left);
+	CHECK;
+	bool own_right = w_eval_borrowed(vm->cur, ast->index.right, vm->this, &right);
+	if(vm->status->tag != W_STATUS_OK) {
+		if(own_left)
+			w_value_release(&left);
+		return W_VM_UNWIND;
+	}
+	w_value_t ret = w_eval_index(vm->cur, ast, &left, &right);
+	if(own_left)
+		w_value_release(&left);
+	if(own_right)
+		w_value_release(&right);
+	CHECK;
+	PUSH(ret);
+	return W_VM_NEXT;
+}
+
+OP_FN(op_enter) {
+	vm->scopes[++vm->depth] = w_ctx_enter(vm->cur, insn->ast->commands.layout);
+	vm->cur = &vm->scopes[vm->depth];
+	return W_VM_NEXT;
+}
+
+OP_FN(op_leave) {
+	w_ctx_free(vm->cur);
+	vm->cur = --vm->depth == 0 ? vm->base : &vm->scopes[vm->depth];
+	return W_VM_NEXT;
+}
+
+OP_FN(op_lookup) {
+	w_ast_t *name = &insn->cmd->ptr[0];
+	w_value_t *v = w_ctx_get_cmd(vm->cur, insn->cmd);
+	if(v == NULL) {
+		char *c = w_ast_cstr(&name->string);
+		w_status_err(vm->status, w_error_new(name->pos, "Unbound string %s.", c));
+		free(c);
+		return W_VM_UNWIND;
+	}
+	if(v->type != W_VALUE_EXTERNCMD && v->type != W_VALUE_COMMAND) {
+		w_status_err(vm->status, w_error_new(name->pos, "0 Expected command, got %s.", w_typename(v->type)));
+		return W_VM_UNWIND;
+	}
+	if(v->type == W_VALUE_EXTERNCMD && v->externcmd->strict == NULL) {
+		// called right away, without a reference or going through W_OP_CALL
+		w_ecmd_t *ecmd = v->externcmd;
+		w_ast_command_t *cmd = insn->cmd;
+		w_value_t ret = ecmd->cmd(name->pos, vm->cur, vm->this, ecmd->obj, (w_args_t){cmd->len-1, cmd->ptr+1});
+		CHECK;
+		PUSH(ret);
+		return W_VM_JUMP;
+	}
+	w_value_ref(v);
+	PUSH(*v);
+	return W_VM_NEXT;
+}
+
+OP_FN(op_call) {
+	w_value_t *vcmd = &vm->stack[vm->sp-1];
+	w_ast_command_t *cmd = insn->cmd;
+	switch(vcmd->type) {
+		case W_VALUE_EXTERNCMD: {
+			w_ecmd_t *ecmd = vcmd->externcmd;
+			if(ecmd->strict != NULL)
+				break;
+			w_value_t ret = ecmd->cmd(cmd->ptr[0].pos, vm->cur, vm->this, ecmd->obj, (w_args_t){cmd->len-1, cmd->ptr+1});
+			CHECK;
+			w_value_release(vcmd);
+			*vcmd = ret;
+			return W_VM_JUMP;
+		}
+		case W_VALUE_COMMAND:
+			break;
+		default:
+			w_status_err(vm->status, w_error_new(cmd->ptr[0].pos, "1 Expected command, got %s.", w_typename(vcmd->type)));
+			return W_VM_UNWIND;
+	}
+	// evaluate the arguments
+	vm->methods[vm->cp] = NULL;
+	vm->calls[vm->cp++] = vm->sp-1;
+	return W_VM_NEXT;
+}
+
+OP_FN(op_method) {
+	w_ast_t *name = &insn->cmd->ptr[0];
+	w_value_t *left = &vm->stack[vm->sp-1];
+	w_strictcmd_t method = w_value_method(left->type, name->index.right->member);
+	if(method != NULL) {
+		// the receiver stays where the command would be
+		vm->methods[vm->cp] = method;
+		vm->calls[vm->cp++] = vm->sp-1;
+		return W_VM_NEXT;
+	}
+	w_value_t right = w_eval_string(name->index.right);
+	w_value_t ret = w_eval_index(vm->cur, name, left, &right);
+	w_value_release(left);
+	w_value_release(&right);
+	vm->sp--;
+	CHECK;
+	PUSH(ret);
+	return op_call(vm, insn);
+}
+
+OP_FN(op_arg) {
+	// strict commands get every argument
+	w_value_t *vcmd = &vm->stack[vm->calls[vm->cp-1]];
+	if(vcmd->type == W_VALUE_COMMAND && insn->int_ >= vcmd->cmd->argc)
+		return W_VM_JUMP;
+	return W_VM_NEXT;
+}
+
+OP_FN(op_invoke) {
+	size_t b = vm->calls[--vm->cp];
+	w_strictcmd_t method = vm->methods[vm->cp];
+	w_value_t *vcmd = &vm->stack[b]; // or the receiver of method, which the call can change
+	size_t argc = vm->sp-b-1;
+	vm->sp = b; // the arguments are consumed by the call
+	w_value_t ret;
+	if(method != NULL || vcmd->type == W_VALUE_EXTERNCMD) {
+		w_value_t *argv = &vm->stack[b+1];
+		if(method != NULL)
+			ret = w_method_invoke(vm->cur, method, vcmd, &insn->cmd->ptr[0], argc, argv, insn->cmd->ptr+1);
+		else
+			ret = w_ecmd_invoke(vm->cur, vcmd->externcmd, &insn->cmd->ptr[0], argc, argv, insn->cmd->ptr+1);
+		for(size_t i = 0; i < argc; i++)
+			w_value_release(&argv[i]);
+	}
+	else
+		ret = w_cmd_call(vm->cur, vcmd->cmd, argc, &vm->stack[b+1], vm->this);
+	w_value_release(vcmd);
+	CHECK;
+	PUSH(ret);
+	return W_VM_NEXT;
+}
+
+OP_FN(op_tail) {
+	size_t b = vm->calls[vm->cp-1];
+	if(vm->stack[b].type != W_VALUE_COMMAND)
+		return op_invoke(vm, insn);
+	w_cmd_t *cmd = vm->stack[b].cmd;
+	size_t argc = vm->sp-b-1;
+	w_tail_t *tail = vm->tail;
+	if(tail == NULL || argc > W_TAIL_ARGS || !w_ctx_droppable(vm->cur, tail->frame, cmd))
+		return op_invoke(vm, insn);
+	// leave the call to w_cmd_call, which makes it once this chunk's scopes are gone. the status is still ok, so unwinding only
+	// cleans up.
+	tail->cmd = cmd;
+	tail->argc = argc;
+	memcpy(tail->argv, &vm->stack[b+1], sizeof(w_value_t)*argc);
+	vm->sp = b;
+	return W_VM_UNWIND;
+}
+
+OP_FN(op_pop) {
+	w_value_release(&vm->stack[--vm->sp]);
+	return W_VM_NEXT;
+}
+
+OP_FN(op_guard) {
+	w_value_t *v = w_ctx_get_cmd(vm->cur, insn->cmd);
+	if(v == NULL || v->type != W_VALUE_EXTERNCMD || v->externcmd->cmd != insn->builtin || v->externcmd->strict != insn->strict)
+		return W_VM_JUMP;
+	return W_VM_NEXT;
+}
+
+// pops right and left, and pushes the result of an arithmetic operation
+#define OP(OP, NAME) OP_FN(op_##NAME) { \
+	w_value_t *left = &vm->stack[vm->sp-2], *right = &vm->stack[vm->sp-1]; \
+	vm->sp--; \
+	if(left->type == W_VALUE_INT && right->type == W_VALUE_INT) { \
+		left->int_ = left->int_ OP right->int_; \
+		return W_VM_NEXT; \
+	} \
+	w_value_t ret = w_value_##NAME(vm->cur, left, right); \
+	w_value_release(left); \
+	w_value_release(right); \
+	vm->sp--; \
+	if(vm->status->tag != W_STATUS_OK) { \
+		vm->status->err->pos = insn->ast->pos; \
+		return W_VM_UNWIND; \
+	} \
+	PUSH(ret); \
+	return W_VM_NEXT; \
+}
+
+OP(+, add)
+OP(-, sub)
+OP(*, mul)
+OP(/, div)
+OP(%, mod)
+
+#undef OP
+
+// pops right and left, and pushes the result of a comparison
+#define CMP(OP, NAME, RES) OP_FN(op_##NAME) { \
+	w_value_t *left = &vm->stack[vm->sp-2], *right = &vm->stack[vm->sp-1]; \
+	vm->sp--; \
+	if(left->type == W_VALUE_INT && right->type == W_VALUE_INT) { \
+		left->int_ = left->int_ OP right->int_; \
+		return W_VM_NEXT; \
+	} \
+	bool ret = RES; \
+	w_value_release(left); \
+	w_value_release(right); \
+	vm->sp--; \
+	CHECK; \
+	PUSH(((w_value_t){.type = W_VALUE_INT, .int_ = ret ? 1 : 0})); \
+	return W_VM_NEXT; \
+}
+
+CMP(==, equ, w_value_equal(left, right))
+CMP(!=, neq, !w_value_equal(left, right))
+CMP(<, lt, w_value_lt(vm->cur, left, right))
+CMP(<=, lte, w_value_lte(vm->cur, left, right))
+CMP(>, gt, w_value_gt(vm->cur, left, right))
+CMP(>=, gte, w_value_gte(vm->cur, left, right))
+
+#undef CMP
+
+OP_FN(op_jump) {
+	return W_VM_JUMP;
+}
+
+OP_FN(op_loop) {
+	if(!w_step(vm->cur, insn->cmd->ptr[0].pos))
+		return W_VM_UNWIND;
+	return W_VM_JUMP;
+}
+
+OP_FN(op_jump_if_not) {
+	w_value_t *v = &vm->stack[--vm->sp];
+	bool t = w_value_truthy(v);
+	w_value_release(v);
+	return t ? W_VM_NEXT : W_VM_JUMP;
+}
+
+OP_FN(op_for_init) {
+	w_value_t *coll = &vm->stack[vm->sp-1];
+	if(coll->type == W_VALUE_LIST) {
+		PUSH(((w_value_t){.type = W_VALUE_INT, .int_ = 0}));
+		PUSH(((w_value_t){.type = W_VALUE_NULL}));
+		return W_VM_NEXT;
+	}
+	// everything else goes through the generic loop, which consumes the collection
+	w_ast_command_t *cmd = insn->cmd;
+	vm->sp--;
+	w_value_t ret = w_for(vm->cur, vm->this, *coll, (w_args_t){cmd->len-1, cmd->ptr+1});
+	CHECK;
+	PUSH(ret);
+	return W_VM_JUMP;
+}
+
+OP_FN(op_for_next) {
+	w_list_t *l = vm->stack[vm->sp-3].list;
+	w_value_t *i = &vm->stack[vm->sp-2];
+	if((size_t)i->int_ >= l->len)
+		return W_VM_JUMP;
+	w_value_release(&vm->stack[--vm->sp]);
+	w_ast_command_t *cmd = insn->cmd;
+	w_ast_t *body = &cmd->ptr[cmd->len-1];
+	vm->scopes[++vm->depth] = w_ctx_enter(vm->cur, body->commands.layout);
+	vm->cur = &vm->scopes[vm->depth];
+	if(cmd->len > 3) {
+		w_value_t item = l->ptr[i->int_];
+		w_value_ref(&item);
+		w_ctx_let_var(vm->cur, &cmd->ptr[cmd->len-3], item);
+		if(cmd->len > 4)
+			w_ctx_let_var(vm->cur, &cmd->ptr[1], *i);
+	}
+	i->int_++;
+	return W_VM_NEXT;
+}
+
+OP_FN(op_for_end) {
+	w_value_release(&vm->stack[vm->sp-3]);
+	vm->stack[vm->sp-3] = vm->stack[vm->sp-1];
+	vm->sp -= 2;
+	return W_VM_NEXT;
+}
+
+OP_FN(op_return) {
+	w_value_t *v = &vm->stack[--vm->sp];
+	w_status_return(vm->status, v);
+	return W_VM_UNWIND;
+}
+
+OP_FN(op_end) {
+	return W_VM_END;
+}
+
+#undef PUSH
+#undef CHECK
+#undef OP_FN
+
+const w_vm_op_t w_vm_ops[] = {
+	[W_OP_NULL] = &op_null,
+	[W_OP_INT] = &op_int,
+	[W_OP_FLOAT] = &op_float,
+	[W_OP_STRING] = &op_string,
+	[W_OP_CONST] = &op_const,
+	[W_OP_VAR] = &op_var,
+	[W_OP_THIS] = &op_this,
+	[W_OP_INDEX] = &op_index,
+	[W_OP_INDEX_BORROW] = &op_index_borrow,
+	[W_OP_ENTER] = &op_enter,
+	[W_OP_LEAVE] = &op_leave,
+	[W_OP_LOOKUP] = &op_lookup,
+	[W_OP_CALL] = &op_call,
+	[W_OP_METHOD] = &op_method,
+	[W_OP_ARG] = &op_arg,
+	[W_OP_INVOKE] = &op_invoke,
+	[W_OP_TAIL] = &op_tail,
+	[W_OP_POP] = &op_pop,
+	[W_OP_GUARD] = &op_guard,
+	[W_OP_ADD] = &op_add,
+	[W_OP_SUB] = &op_sub,
+	[W_OP_MUL] = &op_mul,
+	[W_OP_DIV] = &op_div,
+	[W_OP_MOD] = &op_mod,
+	[W_OP_EQU] = &op_equ,
+	[W_OP_NEQ] = &op_neq,
+	[W_OP_LT] = &op_lt,
+	[W_OP_LTE] = &op_lte,
+	[W_OP_GT] = &op_gt,
+	[W_OP_GTE] = &op_gte,
+	[W_OP_JUMP] = &op_jump,
+	[W_OP_LOOP] = &op_loop,
+	[W_OP_JUMP_IF_NOT] = &op_jump_if_not,
+	[W_OP_FOR_INIT] = &op_for_init,
+	[W_OP_FOR_NEXT] = &op_for_next,
+	[W_OP_FOR_END] = &op_for_end,
+	[W_OP_RETURN] = &op_return,
+	[W_OP_END] = &op_end
+};
+
+// counts a run of a chunk (an entry or a loop iteration), compiling it to native code once it gets hot. returns whether it has
+// native code.
+static bool heat(w_chunk_t *chunk) {
+	if(chunk->jit != NULL)
+		return true;
+	// a chunk the JIT couldn't compile is left with more than jit_hot hits, so it isn't tried again
+	if(!w_options.jit || chunk->hits > w_options.jit_hot || ++chunk->hits < w_options.jit_hot)
+		return false;
+	chunk->hits = w_options.jit_hot+1;
+	w_jit_compile(chunk);
+	return chunk->jit != NULL;
+}
+
+// interprets instructions from ip until the chunk ends or has to unwind. moves on to native code once a loop gets hot.
+static w_vm_result_t run(w_vm_t *vm, w_chunk_t *chunk, w_insn_t *ip) {
+	w_insn_t *code = chunk->code;
+	while(true) {
+		w_insn_t *insn = ip++;
+		switch(w_vm_ops[insn->op](vm, insn)) {
+			case W_VM_NEXT:
+				break;
+			case W_VM_JUMP:
+				ip = code+insn->arg;
+				// jumping backwards means going around a loop
+				if(ip <= insn && heat(chunk))
+					return w_jit_run(chunk, vm, ip);
+				break;
+			case W_VM_UNWIND:
+				vm->insn = insn;
+				return W_VM_UNWIND;
+			case W_VM_END:
+				return W_VM_END;
+		}
+	}
+}
+
+w_value_t w_vm_exec(w_ctx_t *ctx, w_ast_t *ast, w_ctx_t *sub_ctx, w_value_t *this, w_tail_t *tail) {
+	w_chunk_t *chunk = ast->commands.chunk;
+	if(chunk == NULL)
+		chunk = ast->commands.chunk = w_compile(ast);
+	w_value_t stack[chunk->max_stack];
+	size_t calls[chunk->max_stack];
+	w_strictcmd_t methods[chunk->max_stack];
+	w_ctx_t scopes[chunk->max_scopes];
+	w_vm_t vm = (w_vm_t){stack, 0, NULL, ctx->budget, calls, methods, 0, scopes, 0, NULL, NULL, ctx->status, this, tail};
+	if(sub_ctx == NULL) {
+		scopes[0] = w_ctx_enter(ctx, ast->commands.layout);
+		vm.base = &scopes[0];
+	}
+	else
+		vm.base = sub_ctx;
+	vm.cur = vm.base;
+	w_status_t *status = ctx->status;
+	w_insn_t *ip = chunk->code;
+	while(true) {
+		w_vm_result_t res;
+		if(chunk->native != NULL)
+			res = chunk->native->run(chunk, &vm, ip);
+		else
+			res = heat(chunk) ? w_jit_run(chunk, &vm, ip) : run(&vm, chunk, ip);
+		if(res == W_VM_END) {
+			if(sub_ctx == NULL)
+				w_ctx_free(vm.base);
+			return stack[vm.sp-1];
+		}
+		if(status->tag != W_STATUS_BREAK && status->tag != W_STATUS_CONTINUE)
+			break;
+		// find the innermost inline loop whose body this was raised in
+		size_t at = vm.insn-chunk->code;
+		w_handler_t *h = NULL;
+		for(size_t i = 0; i < chunk->handlers_len && h == NULL; i++)
+			if(at >= chunk->handlers[i].start && at < chunk->handlers[i].end)
+				h = &chunk->handlers[i];
+		if(h == NULL)
+			break;
+		while(vm.sp > h->stack)
+			w_value_release(&stack[--vm.sp]);
+		for(; vm.depth > h->scopes; vm.depth--)
+			w_ctx_free(&scopes[vm.depth]);
+		vm.cur = vm.depth == 0 ? vm.base : &scopes[vm.depth];
+		vm.cp = h->calls;
+		ip = chunk->code+(status->tag == W_STATUS_BREAK ? h->brk : h->cont);
+		w_status_ok(status);
+		stack[vm.sp++] = (w_value_t){.type = W_VALUE_NULL};
+	}
+	// errors, returns and tail calls
+	for(size_t i = 0; i < vm.sp; i++)
+		w_value_release(&stack[i]);
+	for(; vm.depth > 0; vm.depth--)
+		w_ctx_free(&scopes[vm.depth]);
+	if(sub_ctx == NULL)
+		w_ctx_free(vm.base);
+	return (w_value_t){};
+}
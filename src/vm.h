@@ -0,0 +1,51 @@
+/// Describes the bytecode virtual machine
+
+#ifndef W_VM_H
+#define W_VM_H
+
+#include "interpreter.h"
+#include "compiler.h"
+
+/// State of a chunk being ran. Native code from the JIT works on this too, so the fields it touches come first.
+typedef struct w_vm {
+	w_value_t *stack; /// Value stack
+	size_t sp; /// Number of values on the stack
+	w_insn_t *insn; /// Instruction that made the chunk unwind
+	w_budget_t *budget; /// Budget of the block's context
+	size_t *calls; /// Stack indices of internal and strict commands whose arguments are being evaluated
+	w_strictcmd_t *methods; /// Method called on the receiver at each index in calls (see W_OP_METHOD), or NULL for commands
+	size_t cp; /// Number of entries in calls
+	w_ctx_t *scopes; /// Nested scopes. scopes[0] is the block's own scope, unless it was given one.
+	size_t depth; /// Index of the innermost scope in scopes
+	w_ctx_t *base; /// Scope of the block
+	w_ctx_t *cur; /// Current scope
+	w_status_t *status; /// Interpreter status
+	w_value_t *this; /// $this
+	w_tail_t *tail; /// Where tail calls are left, or NULL
+} w_vm_t;
+
+/// What running an instruction leads to
+typedef enum w_vm_result {
+	W_VM_NEXT, /// go on to the next instruction
+	W_VM_JUMP, /// jump to the instruction's arg
+	W_VM_UNWIND, /// stop, because the status isn't ok or a tail call was left
+	W_VM_END /// the chunk is done, and its result is on top of the stack
+} w_vm_result_t;
+
+typedef w_vm_result_t (*w_vm_op_t)(w_vm_t *vm, w_insn_t *insn); /// Runs a single instruction
+
+extern const w_vm_op_t w_vm_ops[]; /// Implementation of every opcode
+
+/// Code generated ahead of time for a block (see cgen.h)
+struct w_native {
+	size_t len; /// Number of instructions in the chunk it was generated from
+	w_vm_result_t (*run)(w_chunk_t *chunk, w_vm_t *vm, w_insn_t *ip); /// Runs the chunk from ip, the same way the interpreter loop does
+};
+
+/// Runs a W_AST_COMMANDS node on the VM, compiling it first if it hasn't been compiled yet. Behaves the same as walking the block directly:
+/// if sub_ctx is NULL a new scope is created for the block, otherwise sub_ctx is used as the block's scope.
+/// tail is only given for the body of an internal command. Calls to internal commands in tail position are then left in tail instead
+/// of being made, when that can't be noticed.
+w_value_t w_vm_exec(w_ctx_t *ctx, w_ast_t *ast, w_ctx_t *sub_ctx, w_value_t *this, w_tail_t *tail);
+
+#endif